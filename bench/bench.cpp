@@ -0,0 +1,844 @@
+// Microbenchmarks for the ray-tracing kernels
+// Usage: bench [--max N] [--out results.json] [--filter name]
+// Synthetic and generated scenes grow tenfold from 1K primitives up to --max
+// Results are written as JSON, in ns/op and Mrays/s
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <malloc.h>
+#include <omp.h>
+
+#include "defs.h"
+#include "lbvh.h"
+#include "qbvh.h"
+#include "mbvh.h"
+#include "sbvh.h"
+#include "camera.h"
+#include "scenes.h"
+
+using namespace std;
+
+// Keeps the compiler from dropping a benchmarked result
+template<typename T>
+inline void keep(const T& value) {
+	asm volatile("" : : "g"(&value) : "memory");
+}
+
+struct bench_result {
+	string name;
+	size_t primitives;		// Scene size, 0 if not relevant
+	double ns_per_op;
+	double mrays_per_s;		// 0 if the kernel is not ray-based
+	size_t bytes;			// Acceleration structure footprint, 0 if not relevant
+};
+
+static vector<bench_result> results;
+static vector<BVH_report> bvh_reports;
+
+struct scaling_result {
+	const char* layout;
+	size_t primitives;
+	double generate_ms;
+	double scene_bytes_per_prim;	// Objects, materials and the scene list
+	double bvh_bytes_per_prim;		// Nodes and primitive register
+	double build_ms;
+	double sah_cost;
+	double mrays_per_s;
+};
+
+static vector<scaling_result> scaling_results;
+static const char* filter = nullptr;
+
+static bool selected(const string& name) {
+	return !filter || name.find(filter) != string::npos;
+}
+
+// Runs 'batch' (which performs 'ops' operations) until 'min_seconds' have passed,
+// five times, keeping the fastest run
+template<typename F>
+static double time_ns_per_op(size_t ops, F batch, double min_seconds = .2) {
+	double best = inf;
+	
+	for(int rep = 0; rep < 5; rep++) {
+		size_t done = 0;
+		auto start = chrono::steady_clock::now();
+		double elapsed = 0;
+		
+		do {
+			batch();
+			done += ops;
+			elapsed = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+		} while(elapsed < min_seconds / 5);
+		
+		best = min(best, elapsed * 1e9 / done);
+	}
+	return best;
+}
+
+static void report(const string& name, size_t primitives, double ns_per_op, bool ray_based, size_t bytes = 0) {
+	bench_result res = {name, primitives, ns_per_op, ray_based ? 1e3 / ns_per_op : 0., bytes};
+	results.push_back(res);
+	
+	fprintf(stderr, "%-28s %10zu prims %10.2f ns/op", name.c_str(), primitives, ns_per_op);
+	if(ray_based) fprintf(stderr, " %10.2f Mrays/s", res.mrays_per_s);
+	if(bytes) fprintf(stderr, " %10.1f KiB", bytes / 1024.);
+	fprintf(stderr, "\n");
+}
+
+
+// Fixed seed, so every run measures the same rays and scenes
+static mt19937_64 rng(0x5eed);
+
+static double uniform(double min, double max) {
+	return uniform_real_distribution<double>(min, max)(rng);
+}
+
+static point3 random_in_box(double extent) {
+	return point3(uniform(-extent, extent), uniform(-extent, extent), uniform(-extent, extent));
+}
+
+// Rays starting on a sphere of radius 'distance' aimed at random points of the [-extent, extent] box
+static vector<ray> make_rays(size_t count, double extent, double distance) {
+	vector<ray> rays;
+	rays.reserve(count);
+	for(size_t i = 0; i < count; i++) {
+		point3 origin = distance * normalized(random_in_box(1));
+		point3 target = random_in_box(extent);
+		rays.emplace_back(origin, target - origin, 0.);
+	}
+	return rays;
+}
+
+// Same, aimed at a box and starting outside of it
+static vector<ray> make_rays(size_t count, const AABB& box) {
+	const point3 center = aabb_centroid(box);
+	const vec3 half = .5 * vec3(box.x_i.size(), box.y_i.size(), box.z_i.size());
+	const double distance = 2 * half.len();
+	
+	vector<ray> rays;
+	rays.reserve(count);
+	for(size_t i = 0; i < count; i++) {
+		point3 origin = center + distance * normalized(random_in_box(1));
+		point3 target = center + vec3(uniform(-1, 1) * half[0], uniform(-1, 1) * half[1], uniform(-1, 1) * half[2]);
+		rays.emplace_back(origin, target - origin, 0.);
+	}
+	return rays;
+}
+
+// Heap in use, in bytes, over all malloc arenas
+static size_t heap_bytes(void) {
+	struct mallinfo2 info = mallinfo2();
+	return info.uordblks + info.hblkhd;
+}
+
+static const size_t ray_count = 1 << 14;
+
+
+static void bench_AABB(void) {
+	if(!selected("AABB::hit")) return;
+	
+	AABB box(point3(-1), point3(1));
+	vector<ray> rays = make_rays(ray_count, 1.5, 5);
+	
+	double ns = time_ns_per_op(rays.size(), [&] {
+		int hits = 0;
+		for(const ray& r : rays)
+			hits += box.hit(r, interval::positive);
+		keep(hits);
+	});
+	report("AABB::hit", 1, ns, true);
+}
+
+static void bench_Sphere(void) {
+	if(!selected("Sphere::hit")) return;
+	
+	Sphere sphere(point3(0), 1, make_shared<Lambertian>(color(.5)));
+	vector<ray> rays = make_rays(ray_count, 1.5, 5);
+	
+	double ns = time_ns_per_op(rays.size(), [&] {
+		int hits = 0;
+		for(const ray& r : rays) {
+			hit_record rec;
+			hits += sphere.hit(r, interval::positive, rec);
+		}
+		keep(hits);
+	});
+	report("Sphere::hit", 1, ns, true);
+}
+
+static void bench_Quad(void) {
+	if(!selected("Quad::hit")) return;
+	
+	Quad quad(point3(-1, -1, 0), vec3(2, 0, 0), vec3(0, 2, 0), make_shared<Lambertian>(color(.5)));
+	vector<ray> rays = make_rays(ray_count, 1.5, 5);
+	
+	double ns = time_ns_per_op(rays.size(), [&] {
+		int hits = 0;
+		for(const ray& r : rays) {
+			hit_record rec;
+			hits += quad.hit(r, interval::positive, rec);
+		}
+		keep(hits);
+	});
+	report("Quad::hit", 1, ns, true);
+}
+
+// Unit gas sphere, entry and exit come from one boundary query
+static void bench_Constant_Medium(void) {
+	if(!selected("Constant_Medium::hit")) return;
+	
+	auto boundary = make_shared<Sphere>(point3(0), 1, make_shared<Lambertian>(color(.5)));
+	Constant_Medium medium(boundary, .5, color(.7));
+	vector<ray> rays = make_rays(ray_count, 1.5, 5);
+	
+	double ns = time_ns_per_op(rays.size(), [&] {
+		int hits = 0;
+		for(const ray& r : rays) {
+			hit_record rec;
+			hits += medium.hit(r, interval::positive, rec);
+		}
+		keep(hits);
+	});
+	report("Constant_Medium::hit", 1, ns, true);
+}
+
+// Smoke ball on a 64^3 grid, denser at the center and empty in the corners
+static void bench_Grid_Medium(void) {
+	if(!selected("Grid_Medium")) return;
+	
+	auto density = [](const point3& p) {
+		double d = 1 - p.len();
+		return (d > 0) ? float(2 * d) : 0.f;
+	};
+	Grid_Medium medium(AABB(point3(-1), point3(1)), 64, 64, 64, density, color(.7));
+	vector<ray> rays = make_rays(ray_count, 1.5, 5);
+	
+	double ns = time_ns_per_op(rays.size(), [&] {
+		int hits = 0;
+		for(const ray& r : rays) {
+			hit_record rec;
+			hits += medium.hit(r, interval::positive, rec);
+		}
+		keep(hits);
+	});
+	report("Grid_Medium::hit", 1, ns, true, medium.memory_bytes());
+	
+	ns = time_ns_per_op(rays.size(), [&] {
+		double sum = 0;
+		for(const ray& r : rays)
+			sum += medium.transmittance(r, interval::positive);
+		keep(sum);
+	});
+	report("Grid_Medium::transmittance", 1, ns, true, medium.memory_bytes());
+	
+	// Against exp(-optical depth) along x, through uniform bricks (closed form)
+	// and one brick split at x = 1/8, mid-brick, that ratio tracking steps through
+	auto slab = [](const point3& p) {return (p.x() < .125) ? 1.f : .5f;};
+	Grid_Medium split(AABB(point3(-1), point3(1)), 64, 64, 64, slab, color(.7));
+	const double expected = std::exp(-(1.125 * 1 + .875 * .5));
+	
+	const size_t estimates = 1 << 18;
+	double sum = 0;
+	for(size_t i = 0; i < estimates; i++)
+		sum += split.transmittance(ray(point3(-2, uniform(-.9, .9), uniform(-.9, .9)), vec3(1, 0, 0)), interval::positive);
+	fprintf(stderr, "%-28s %10.2e relative error\n", "Grid_Medium::transmittance", std::fabs(sum / estimates / expected - 1));
+}
+
+// Random spheres in [-1, 1]^3, sized so the scene stays about as dense at every count
+static void bench_LBVH(size_t max_primitives) {
+	if(!selected("LBVH::hit")) return;
+	
+	auto mat = make_shared<Lambertian>(color(.5));
+	
+	for(size_t n = 1000; n <= max_primitives; n *= 10) {
+		hittable_list list;
+		double radius = .5 / std::cbrt(double(n));
+		for(size_t i = 0; i < n; i++)
+			list.add(make_shared<Sphere>(random_in_box(1), radius, mat));
+		
+		LBVH bvh(list);
+		report("LBVH::build", n, bvh.build_times.total_ms * 1e6 / n, false);
+		bvh_reports.push_back(bvh.report());
+		
+		vector<ray> rays = make_rays(ray_count, 1, 5);
+		auto trace = [&rays](const IHittable& tree) {
+			return time_ns_per_op(rays.size(), [&] {
+				int hits = 0;
+				for(const ray& r : rays) {
+					hit_record rec;
+					hits += tree.hit(r, interval::positive, rec);
+				}
+				keep(hits);
+			});
+		};
+		report("LBVH::hit", n, trace(bvh), true, bvh.tree_node_count() * sizeof(BVH_node));
+		
+		// Same tree with compressed nodes
+		QBVH8 qbvh8(bvh);
+		report("QBVH8::hit", n, trace(qbvh8), true, qbvh8.node_count() * sizeof(QBVH_node<uint8_t>));
+		QBVH16 qbvh16(bvh);
+		report("QBVH16::hit", n, trace(qbvh16), true, qbvh16.node_count() * sizeof(QBVH_node<uint16_t>));
+		
+		// Same tree, nodes in van Emde Boas order
+		bvh.reorder(ORDER_VAN_EMDE_BOAS);
+		report("LBVH::hit vEB", n, trace(bvh), true, bvh.tree_node_count() * sizeof(BVH_node));
+	}
+}
+
+// Object-split LBVH against the spatial-split builder on the same scene
+static void bench_SBVH_scene(const char* name, const hittable_list& list) {
+	vector<ray> rays = make_rays(ray_count, list.bounding_box());
+	auto trace = [&rays](const IHittable& tree) {
+		return time_ns_per_op(rays.size(), [&] {
+			int hits = 0;
+			for(const ray& r : rays) {
+				hit_record rec;
+				hits += tree.hit(r, interval::positive, rec);
+			}
+			keep(hits);
+		});
+	};
+	
+	const size_t n = list.objects.size();
+	LBVH lbvh(list);
+	auto sbvh = SBVH::build(list);
+	bvh_reports.push_back(lbvh.report());
+	bvh_reports.push_back(sbvh->report());
+	
+	report(string("LBVH::build/") + name, n, lbvh.build_times.total_ms * 1e6 / n, false);
+	report(string("SBVH::build/") + name, n, sbvh->build_times.total_ms * 1e6 / n, false);
+	report(string("LBVH::hit/") + name, n, trace(lbvh), true, lbvh.tree_node_count() * sizeof(BVH_node));
+	report(string("SBVH::hit/") + name, n, trace(*sbvh), true, sbvh->tree_node_count() * sizeof(BVH_node));
+}
+
+static void bench_SBVH(size_t max_primitives) {
+	if(!selected("SBVH")) return;
+	
+	{
+		hittable_list list;
+		scene_cornellScene(list, 5);
+		bench_SBVH_scene("cornell", list);
+	}
+	{
+		hittable_list list;
+		scene_bookScene(list);
+		bench_SBVH_scene("book", list);
+	}
+	{
+		// Half quads, no media (they are never split)
+		generator_params params;
+		params.count = min<size_t>(100000, max_primitives);
+		params.layout = LAYOUT_CLUSTERED;
+		params.quad_fraction = .5;
+		params.volume_fraction = 0;
+		
+		hittable_list list;
+		scene_generatedScene(list, params);
+		bench_SBVH_scene("clustered", list);
+	}
+}
+
+// Swept boxes in an LBVH against time-interpolated bounds in an MBVH,
+// with one tree or one per quarter of the shutter
+static void bench_motion_scene(const string& name, const hittable_list& moving, const hittable_list* still, const AABB& target) {
+	// Rays spread over the shutter
+	vector<ray> rays = make_rays(ray_count, target);
+	for(ray& r : rays)
+		r = ray(r.origin(), r.direction(), uniform(0, 1));
+	
+	auto trace = [&rays](const IHittable& tree) {
+		return time_ns_per_op(rays.size(), [&] {
+			int hits = 0;
+			for(const ray& r : rays) {
+				hit_record rec;
+				hits += tree.hit(r, interval::positive, rec);
+			}
+			keep(hits);
+		});
+	};
+	
+	const size_t n = moving.objects.size();
+	if(still) {
+		LBVH still_bvh(*still);
+		report("LBVH::hit/still" + name, n, trace(still_bvh), true, still_bvh.tree_node_count() * sizeof(BVH_node));
+	}
+	
+	LBVH moving_bvh(moving);
+	MBVH motion_bvh(moving_bvh);
+	MBVH split_bvh(moving.objects, 4);
+	report("LBVH::hit/motion" + name, n, trace(moving_bvh), true, moving_bvh.tree_node_count() * sizeof(BVH_node));
+	report("MBVH::hit/motion" + name, n, trace(motion_bvh), true, motion_bvh.node_count() * sizeof(MBVH_node));
+	report("MBVH::hit/motion x4" + name, n, trace(split_bvh), true, split_bvh.node_count() * sizeof(MBVH_node));
+}
+
+// Fast moving spheres in random directions, and held still for reference,
+// then the bouncing spheres of the book scene
+static void bench_motion(size_t max_primitives) {
+	if(!selected("motion")) return;
+	
+	auto mat = make_shared<Lambertian>(color(.5));
+	
+	for(size_t n = 1000; n <= min<size_t>(max_primitives, 100000); n *= 10) {
+		hittable_list still, moving;
+		double radius = .5 / std::cbrt(double(n));
+		for(size_t i = 0; i < n; i++) {
+			point3 center = random_in_box(1);
+			vec3 path = uniform(0, .5) * normalized(random_in_box(1));
+			still.add(make_shared<Sphere>(center, radius, mat));
+			moving.add(make_shared<Sphere>(center - .5 * path, center + .5 * path, radius, mat));
+		}
+		bench_motion_scene("", moving, &still, moving.bounding_box());
+	}
+	
+	// Rays aimed at the small spheres, not the ground
+	hittable_list book;
+	scene_bookScene(book);
+	AABB target = AABB::empty;
+	for(const auto& obj : book.objects)
+		if(obj->bounding_box().x_i.size() < 10) target = AABB(target, obj->bounding_box());
+	bench_motion_scene("/book", book, nullptr, target);
+}
+
+// Generated scenes of growing size, one series per layout
+static void bench_scaling(size_t max_primitives) {
+	if(!selected("scale")) return;
+	
+	const Scene_Layout layouts[] = {LAYOUT_UNIFORM, LAYOUT_CLUSTERED, LAYOUT_LONG_THIN};
+	const char* layout_names[] = {"uniform", "clustered", "long_thin"};
+	
+	for(int l = 0; l < 3; l++) {
+		for(size_t n = 1000; n <= max_primitives; n *= 10) {
+			scaling_result res = {};
+			res.layout = layout_names[l];
+			res.primitives = n;
+			
+			generator_params params;
+			params.count = n;
+			params.layout = layouts[l];
+			
+			size_t heap_start = heap_bytes();
+			auto gen_start = chrono::steady_clock::now();
+			
+			hittable_list list;
+			scene_generatedScene(list, params);
+			
+			res.generate_ms = chrono::duration<double, milli>(chrono::steady_clock::now() - gen_start).count();
+			size_t heap_scene = heap_bytes();
+			
+			{
+				LBVH bvh(list);
+				res.build_ms = bvh.build_times.total_ms;
+				res.sah_cost = bvh.report().sah_cost;
+				res.scene_bytes_per_prim = double(heap_scene - heap_start) / n;
+				res.bvh_bytes_per_prim = double(heap_bytes() - heap_scene) / n;
+				
+				vector<ray> rays = make_rays(ray_count, bvh.bounding_box());
+				double ns = time_ns_per_op(rays.size(), [&] {
+					int hits = 0;
+					for(const ray& r : rays) {
+						hit_record rec;
+						hits += bvh.hit(r, interval::positive, rec);
+					}
+					keep(hits);
+				}, .1);
+				res.mrays_per_s = 1e3 / ns;
+			}
+			scaling_results.push_back(res);
+			
+			fprintf(stderr, "scale/%-22s %10zu prims %8.1f ms gen %8.1f ms build %6.1f+%-6.1f B/prim %8.2f Mrays/s\n",
+				res.layout, n, res.generate_ms, res.build_ms,
+				res.scene_bytes_per_prim, res.bvh_bytes_per_prim, res.mrays_per_s);
+		}
+	}
+}
+
+static void bench_rand(void) {
+	if(!selected("get_rand_double")) return;
+	
+	const size_t ops = 1 << 16;
+	double ns = time_ns_per_op(ops, [&] {
+		double sum = 0;
+		for(size_t i = 0; i < ops; i++)
+			sum += get_rand_double();
+		keep(sum);
+	});
+	report("get_rand_double", 0, ns, false);
+}
+
+static void bench_get_color(void) {
+	if(!selected("get_color") && !selected("resolve")) return;
+	
+	vector<color> colors(1 << 14);
+	for(color& c : colors)
+		c = color(uniform(0, 1.2), uniform(0, 1.2), uniform(0, 1.2));
+	
+	double ns = time_ns_per_op(colors.size(), [&] {
+		uint32_t acc = 0;
+		for(const color& c : colors)
+			acc ^= get_color(c);
+		keep(acc);
+	});
+	report("get_color", 0, ns, false);
+	
+	// Same pixels through the bulk resolve stage
+	Float_Image hdr(int(colors.size()), 1, 3);
+	for(size_t i = 0; i < colors.size(); i++)
+		for(int c = 0; c < 3; c++)
+			hdr.plane(c)[i] = colors[i][c];
+	
+	vector<uint32_t> out(colors.size());
+	Resolver resolver;
+	const char* names[] = {"resolve/clamp", "resolve/reinhard", "resolve/aces"};
+	const Tonemap tonemaps[] = {TONEMAP_CLAMP, TONEMAP_REINHARD, TONEMAP_ACES};
+	for(int t = 0; t < 3; t++) {
+		resolver.tonemap = tonemaps[t];
+		ns = time_ns_per_op(colors.size(), [&] {
+			resolver.run(hdr, out.data());
+			keep(out.back());
+		});
+		report(names[t], 0, ns, false);
+	}
+}
+
+
+// One bounce of shading over a mix of the built-in materials,
+// through the virtual interface and through the flat form
+static void bench_shading(void) {
+	if(!selected("shade")) return;
+	
+	vector<shared_ptr<IMaterial>> materials = {
+		make_shared<Lambertian>(color(.5)),
+		make_shared<Metal>(color(.8), .2),
+		make_shared<Dielectric>(1.5),
+		make_shared<Emitter>(color(4)),
+		make_shared<Isotropic>(color(.7)),
+		make_shared<Lambertian>(make_shared<Checker_Texture>(.3, color(.1), color(.9)))
+	};
+	
+	vector<hit_record> hits(1 << 14);
+	vector<ray> rays = make_rays(hits.size(), 1, 5);
+	for(size_t i = 0; i < hits.size(); i++) {
+		hit_record& rec = hits[i];
+		rec.p = random_in_box(1);
+		rec.set_face_normal(rays[i], normalized(random_in_box(1)));
+		rec.u = uniform(0, 1);
+		rec.v = uniform(0, 1);
+		rec.mat = materials[size_t(uniform(0, materials.size())) % materials.size()].get();
+	}
+	
+	double ns = time_ns_per_op(hits.size(), [&] {
+		color sum(0);
+		for(size_t i = 0; i < hits.size(); i++) {
+			color attenuation;
+			ray scattered;
+			sum += hits[i].mat->emitted(hits[i].u, hits[i].v, hits[i].p);
+			if(hits[i].mat->scatter(rays[i], hits[i], attenuation, scattered)) sum += attenuation;
+		}
+		keep(sum);
+	});
+	report("shade/virtual", materials.size(), ns, false);
+	
+	ns = time_ns_per_op(hits.size(), [&] {
+		color sum(0);
+		for(size_t i = 0; i < hits.size(); i++) {
+			color attenuation;
+			ray scattered;
+			sum += shade_emitted(hits[i].mat, hits[i]);
+			if(shade_scatter(hits[i].mat, rays[i], hits[i], attenuation, scattered)) sum += attenuation;
+		}
+		keep(sum);
+	});
+	report("shade/flat", materials.size(), ns, false);
+}
+
+
+// Lookups in a nested checker/stripe graph, through virtual calls
+// and through the compiled program; the size column is the node count
+static void bench_texture(void) {
+	if(!selected("texture")) return;
+	
+	auto inner = make_shared<Lollipop_Texture>(8, color(.2, .3, .1), color(.9));
+	auto mixed = make_shared<Checker_Texture>(.1, inner, make_shared<Uniform_Color>(color(.5)));
+	shared_ptr<ITexture> tex = make_shared<Checker_Texture>(.7, mixed,
+		make_shared<Checker_Texture>(.05, inner, make_shared<Uniform_Color>(color(.1, .1, .4))));
+	
+	Texture_Program program(*tex);
+	
+	const size_t n = 1 << 14;
+	vector<double> u(n), v(n);
+	vector<point3> p(n);
+	for(size_t i = 0; i < n; i++) {
+		u[i] = uniform(0, 1);
+		v[i] = uniform(0, 1);
+		p[i] = random_in_box(5);
+	}
+	
+	double ns = time_ns_per_op(n, [&] {
+		color sum(0);
+		for(size_t i = 0; i < n; i++)
+			sum += tex->value(u[i], v[i], p[i]);
+		keep(sum);
+	});
+	report("texture/virtual", program.node_count(), ns, false);
+	
+	ns = time_ns_per_op(n, [&] {
+		color sum(0);
+		for(size_t i = 0; i < n; i++)
+			sum += program.eval(u[i], v[i], p[i]);
+		keep(sum);
+	});
+	report("texture/compiled", program.node_count(), ns, false);
+}
+
+
+// Largest error of the fast math functions against libm in double, over their domains,
+// in ulps where the bound is relative and absolute otherwise
+// Checked against the bounds documented in utils/fastmath.h, the bench fails past them.
+struct math_result {
+	const char* name;
+	double max_error;
+	double bound;
+	const char* unit;
+};
+
+static vector<math_result> math_results;
+static int failures = 0;
+
+static double ulp_error(float value, double reference) {
+	// From the exponent: a float subtraction would flush small ulps to 0 under -ffast-math
+	const float r = std::fabs(float(reference));
+	const double ulp = std::ldexp(1., std::max(std::ilogb(r), std::numeric_limits<float>::min_exponent - 1) - 23);
+	return std::fabs(value - reference) / ulp;
+}
+
+template<typename F, typename R>
+static void check_math(const char* name, double bound, bool relative, const vector<float>& x, const vector<float>& y, F fast, R reference) {
+	math_result res = {name, 0, bound, relative ? "ulp" : "abs"};
+	for(size_t i = 0; i < x.size(); i++) {
+		const float value = fast(x[i], y[i]);
+		const double ref = reference(double(x[i]), double(y[i]));
+		res.max_error = max(res.max_error, relative ? ulp_error(value, ref) : std::fabs(value - ref));
+	}
+	math_results.push_back(res);
+	
+	const bool fail = !(res.max_error <= bound);
+	if(fail) failures++;
+	fprintf(stderr, "%-28s %10.3g %s%s\n", name, res.max_error, res.unit, fail ? "  FAIL" : "");
+}
+
+// Throughput of a libm call and of its approximation, one value at a time as the
+// renderer makes them: keeping each result stops the loop from being vectorized
+template<typename F>
+static void time_math(const string& name, const vector<float>& x, const vector<float>& y, F f) {
+	double ns = time_ns_per_op(x.size(), [&] {
+		for(size_t i = 0; i < x.size(); i++) {
+			const float value = f(x[i], y[i]);
+			keep(value);
+		}
+	});
+	report(name, 0, ns, false);
+}
+
+template<typename B>
+static void time_math_batch(const string& name, size_t n, B batch) {
+	double ns = time_ns_per_op(n, batch);
+	report(name, 0, ns, false);
+}
+
+static void bench_math(void) {
+	if(!selected("math")) return;
+	
+	const size_t n = 1 << 16;
+	vector<float> any(n), unit(n), angle(n), positive(n), x(n), y(n), out(n), out2(n);
+	for(size_t i = 0; i < n; i++) {
+		any[i] = uniform(-1, 1);
+		unit[i] = uniform(0, 1);
+		angle[i] = uniform(-100, 100);
+		positive[i] = std::exp2(uniform(-120, 120));
+		x[i] = uniform(-1, 1);
+		y[i] = uniform(-1, 1);
+	}
+	
+	// Accuracy, including the ranges the renderer passes
+	check_math("math/log accuracy", 2.5, true, positive, positive, [](float v, float) {return fast_log(v);}, [](double v, double) {return std::log(v);});
+	check_math("math/log unit accuracy", 2.5, true, unit, unit, [](float v, float) {return fast_log(v);}, [](double v, double) {return std::log(v);});
+	check_math("math/sin accuracy", 1e-7, false, angle, angle, [](float v, float) {float s, c; fast_sincos(v, s, c); return s;}, [](double v, double) {return std::sin(v);});
+	check_math("math/cos accuracy", 1e-7, false, angle, angle, [](float v, float) {float s, c; fast_sincos(v, s, c); return c;}, [](double v, double) {return std::cos(v);});
+	check_math("math/acos accuracy", 6e-7, false, any, any, [](float v, float) {return fast_acos(v);}, [](double v, double) {return std::acos(v);});
+	check_math("math/atan2 accuracy", 4e-7, false, y, x, [](float a, float b) {return fast_atan2(a, b);}, [](double a, double b) {return std::atan2(a, b);});
+	
+	// Throughput
+	time_math("math/log libm", unit, unit, [](float v, float) {return std::log(v);});
+	time_math("math/log fast", unit, unit, [](float v, float) {return fast_log(v);});
+	time_math_batch("math/log batch", n, [&] {fast_log_batch(n, unit.data(), out.data()); keep(out[n-1]);});
+	
+	time_math("math/sincos libm", angle, angle, [](float v, float) {return std::sin(v) + std::cos(v);});
+	time_math("math/sincos fast", angle, angle, [](float v, float) {float s, c; fast_sincos(v, s, c); return s + c;});
+	time_math_batch("math/sincos batch", n, [&] {fast_sincos_batch(n, angle.data(), out.data(), out2.data()); keep(out2[n-1]);});
+	
+	time_math("math/acos libm", any, any, [](float v, float) {return std::acos(v);});
+	time_math("math/acos fast", any, any, [](float v, float) {return fast_acos(v);});
+	time_math_batch("math/acos batch", n, [&] {fast_acos_batch(n, any.data(), out.data()); keep(out[n-1]);});
+	
+	time_math("math/atan2 libm", y, x, [](float a, float b) {return std::atan2(a, b);});
+	time_math("math/atan2 fast", y, x, [](float a, float b) {return fast_atan2(a, b);});
+	time_math_batch("math/atan2 batch", n, [&] {fast_atan2_batch(n, y.data(), x.data(), out.data()); keep(out[n-1]);});
+}
+
+
+// End-to-end frames of the built-in scenes
+static void bench_frame(const char* name, hittable_list& list, const point3& eye, const point3& focus) {
+	string full_name = string("frame/") + name;
+	if(!selected(full_name)) return;
+	
+	const int width = 320, height = 240;
+	
+	size_t primitives = list.objects.size();
+	hittable_list world(make_shared<LBVH>(list));
+	
+	Camera cam(world);
+	cam.eye_point = eye;
+	cam.foc_point = focus;
+	cam.camera_up = vec3(0,1,0);
+	cam.FOV = 100;
+	cam.init_CAMERA(width, height);
+	
+	#ifdef SAMPLING_MODE
+		const size_t rays = size_t(width) * height * cam.samples_per_pixel;
+	#else
+		const size_t rays = size_t(width) * height;
+	#endif
+	
+	// Camera rays only, secondary bounces are part of the per-ray cost
+	double ns = time_ns_per_op(rays, [&] {cam.compute_FRAME();}, 2.);
+	report(full_name, primitives, ns, true);
+	fprintf(stderr, "%-28s %10.2f ms/frame\n", "", ns * rays * 1e-6);
+}
+
+static void bench_frames(void) {
+	{
+		hittable_list list;
+		float dim = 5;
+		scene_cornellScene(list, dim);
+		bench_frame("cornell", list, point3(0,dim/2,dim), point3(0,dim/2,-dim));
+	}
+	{
+		hittable_list list;
+		scene_bookScene(list);
+		bench_frame("book", list, point3(13,2,3), point3(0));
+	}
+	{
+		hittable_list list;
+		scene_earthScene(list);
+		bench_frame("earth", list, point3(0,2,12), point3(0,2,0));
+	}
+}
+
+
+static void write_json(FILE* out) {
+	fprintf(out, "{\n");
+	#ifdef SAMPLING_MODE
+		fprintf(out, "  \"sampling\": true,\n");
+	#else
+		fprintf(out, "  \"sampling\": false,\n");
+	#endif
+	fprintf(out, "  \"threads\": %d,\n", omp_get_max_threads());
+	fprintf(out, "  \"results\": [\n");
+	for(size_t i = 0; i < results.size(); i++) {
+		const bench_result& res = results[i];
+		fprintf(out, "    {\"name\": \"%s\", \"primitives\": %zu, \"ns_per_op\": %.3f, \"mrays_per_s\": %.3f, \"bytes\": %zu}%s\n",
+			res.name.c_str(), res.primitives, res.ns_per_op, res.mrays_per_s, res.bytes,
+			(i + 1 < results.size()) ? "," : "");
+	}
+	fprintf(out, "  ],\n");
+	
+	// Tree quality of the synthetic LBVH scenes, then LBVH / SBVH pairs
+	fprintf(out, "  \"bvh\": [\n");
+	for(size_t i = 0; i < bvh_reports.size(); i++) {
+		const BVH_report& rep = bvh_reports[i];
+		fprintf(out, "    {\"primitives\": %zu, \"nodes\": %zu, \"leaves\": %zu, \"max_depth\": %zu, "
+			"\"sah_cost\": %.3f, \"overlap_ratio\": %.4f, \"bytes\": %zu, "
+			"\"bounds_ms\": %.3f, \"construct_ms\": %.3f}%s\n",
+			rep.primitive_count, rep.node_count, rep.leaf_count, rep.max_depth,
+			rep.sah_cost, rep.overlap_ratio, rep.node_bytes + rep.register_bytes,
+			rep.times.bounds_ms, rep.times.construct_ms,
+			(i + 1 < bvh_reports.size()) ? "," : "");
+	}
+	fprintf(out, "  ],\n");
+	
+	// Generated scenes, per layout and size
+	fprintf(out, "  \"scaling\": [\n");
+	for(size_t i = 0; i < scaling_results.size(); i++) {
+		const scaling_result& res = scaling_results[i];
+		fprintf(out, "    {\"layout\": \"%s\", \"primitives\": %zu, \"generate_ms\": %.3f, "
+			"\"scene_bytes_per_prim\": %.1f, \"bvh_bytes_per_prim\": %.1f, "
+			"\"build_ms\": %.3f, \"sah_cost\": %.3f, \"mrays_per_s\": %.3f}%s\n",
+			res.layout, res.primitives, res.generate_ms,
+			res.scene_bytes_per_prim, res.bvh_bytes_per_prim,
+			res.build_ms, res.sah_cost, res.mrays_per_s,
+			(i + 1 < scaling_results.size()) ? "," : "");
+	}
+	fprintf(out, "  ],\n");
+	
+	// Fast math accuracy against libm
+	fprintf(out, "  \"math\": [\n");
+	for(size_t i = 0; i < math_results.size(); i++) {
+		const math_result& res = math_results[i];
+		fprintf(out, "    {\"name\": \"%s\", \"max_error\": %.3g, \"bound\": %.3g, \"unit\": \"%s\"}%s\n",
+			res.name, res.max_error, res.bound, res.unit,
+			(i + 1 < math_results.size()) ? "," : "");
+	}
+	fprintf(out, "  ]\n}\n");
+}
+
+int main(int argc, char** argv) {
+	size_t max_primitives = 10000000;
+	const char* out_path = nullptr;
+	
+	for(int i = 1; i < argc; i++) {
+		if(!strcmp(argv[i], "--max") && i + 1 < argc)
+			max_primitives = strtoull(argv[++i], nullptr, 10);
+		else if(!strcmp(argv[i], "--out") && i + 1 < argc)
+			out_path = argv[++i];
+		else if(!strcmp(argv[i], "--filter") && i + 1 < argc)
+			filter = argv[++i];
+		else {
+			fprintf(stderr, "Usage: %s [--max N] [--out results.json] [--filter name]\n", argv[0]);
+			return 1;
+		}
+	}
+	
+	bench_AABB();
+	bench_Sphere();
+	bench_Quad();
+	bench_Constant_Medium();
+	bench_Grid_Medium();
+	bench_LBVH(max_primitives);
+	bench_SBVH(max_primitives);
+	bench_motion(max_primitives);
+	bench_scaling(max_primitives);
+	bench_rand();
+	bench_get_color();
+	bench_shading();
+	bench_texture();
+	bench_math();
+	bench_frames();
+	
+	FILE* out = out_path ? fopen(out_path, "w") : stdout;
+	if(!out) {
+		perror("Could not open output file");
+		return 1;
+	}
+	write_json(out);
+	if(out != stdout) fclose(out);
+	
+	if(failures) fprintf(stderr, "%d accuracy checks failed\n", failures);
+	return failures ? 1 : 0;
+}
\ No newline at end of file
@@ -2,9 +2,60 @@
 #define CAMERA_H
 
 #include "utils.h"
+#include "denoiser.h"
+#include "resolve.h"
 #include <memory>
 #include <omp.h>
 
+// First-hit data of a camera ray, feeds the AOV planes
+struct aov_sample {
+	color  albedo = color(1);
+	vec3   normal = vec3(0);
+	double depth  = 0;
+};
+
+// Where the camera stands and looks
+// Moved by the input handler, applied by the renderer between frames
+struct Camera_Pose {
+	point3 eye_point;
+	point3 foc_point;
+	vec3   camera_up;
+	
+	void foc_forward(float step) {
+		foc_point += vec3(0,0,-step);
+	}
+	
+	void foc_rise(float step) {
+		foc_point += vec3(0,step,0);
+	}
+	
+	void foc_right(float step) {
+		foc_point += vec3(step,0,0);
+	}
+	
+	void forward(float step) {
+		eye_point += vec3(0,0,-step);
+	}
+	
+	void rise(float step) {
+		eye_point += vec3(0,step,0);
+	}
+	
+	void right(float step) {
+		eye_point += vec3(step,0,0);
+	}
+};
+
+// Planes of the temporal history: blended radiance, first-hit surface
+// and the number of frames blended in (0 where nothing was hit)
+enum History_Channel {
+	HIST_R, HIST_G, HIST_B,
+	HIST_PX, HIST_PY, HIST_PZ,
+	HIST_NX, HIST_NY, HIST_NZ,
+	HIST_COUNT,
+	HIST_CHANNELS
+};
+
 class Camera {
 	private:
 		hittable_list world;
@@ -30,20 +81,78 @@ class Camera {
 		
 		constexpr static uint32_t default_pixel = 0xFFU << 24;
 		
+		// Sum of the refined frames, and their count
+		Float_Image accum_buffer;
+		int accumulated = 0;
+		
+		// Viewport a history was rendered from
+		struct View {
+			point3 eye, pixel_00;
+			vec3 delta_h, delta_v, forward;
+			float focal_length;
+			int width, height;
+		};
+		
+		// Last frame and the one being written, swapped each frame
+		// The history keeps its own view, so it outlives moves and resizes
+		Float_Image history, next_history;
+		View history_view;
+		bool history_valid = false;
+		
+		// History is dropped where the surface moved off its plane by more
+		// than this fraction of the depth, or turned too far
+		static constexpr float plane_tolerance = .01f;
+		static constexpr float normal_tolerance = .9f;
+		
+		// Blends the frame with the history reprojected into it
+		void reproject(void);
+		
 		#ifdef SAMPLING_MODE	
 			float pixel_samples_scale;
 		#endif
 		
 		
 		// get color func
-		color ray_color(const ray& r, int bounces) const;
+		// 'aov' is filled at the first hit only
+		color ray_color(const ray& r, int bounces, aov_sample* aov = nullptr) const;
 		
 		ray get_ray(int x, int y) const;
 		
+		// Every sample of pixel (x, y), averaged
+		color render_PIXEL(int x, int y, aov_sample& aov) const;
+		
 		
 	public:
 		std::vector<uint32_t> display_buffer;
 		int display_buffer_size;
+		
+		// Linear HDR radiance (3 planes) and first-hit AOVs,
+		// resolved into 'display_buffer' at the end of the frame
+		Float_Image frame_buffer;
+		Float_Image aov_buffer;
+		
+		Denoiser denoiser;
+		bool denoise = false;
+		
+		// Exposure, tonemapping and gamma of 'display_buffer'
+		Resolver resolver;
+		
+		// Frames from the same pose are averaged, with samples
+		// spread over each pixel, until the pose or resolution changes
+		bool refine = false;
+		
+		// Frames are blended with the previous ones reprojected through
+		// their first hits, so small moves keep most of the converged image
+		// Refined frames then lift the history length limit
+		bool temporal = false;
+		int temporal_frames = 16;		// History length while moving
+		
+		#ifdef STATS_MODE
+			// Counters of the last frame, and its per-pixel cost
+			// (BVH nodes visited + primitive tests)
+			frame_stats stats;
+			Float_Image cost_buffer;
+		#endif
 		#ifdef SAMPLING_MODE
 			int samples_per_pixel = 5;
 		#endif
@@ -80,6 +189,13 @@ class Camera {
 			
 			display_buffer_size = sizeof(uint32_t) * WIN_SIZE;
 			display_buffer.resize(WIN_SIZE);
+			frame_buffer.resize(WIN_WIDTH, WIN_HEIGHT, 3);
+			accum_buffer.resize(WIN_WIDTH, WIN_HEIGHT, 3);
+			accumulated = 0;
+			aov_buffer.resize(WIN_WIDTH, WIN_HEIGHT, AOV_COUNT);
+			#ifdef STATS_MODE
+				cost_buffer.resize(WIN_WIDTH, WIN_HEIGHT, 1);
+			#endif
 			
 			focal_length = VIEWPORT_WIDTH/(2*std::tan(degrees_to_radians(FOV)/2));
 			
@@ -104,10 +220,28 @@ class Camera {
 			pixel_00 = viewport_00 + 0.5 * (pixel_delta_h + pixel_delta_v);
 		}
 		
+		// Re-inits the camera if the size changes
+		void set_resolution(const int WIDTH, const int HEIGHT) {
+			if(WIDTH != WIN_WIDTH || HEIGHT != WIN_HEIGHT)
+				init_CAMERA(WIDTH, HEIGHT);
+		}
+		
+		int width(void) const {return WIN_WIDTH;}
+		int height(void) const {return WIN_HEIGHT;}
+		
+		int accumulated_frames(void) const {return accumulated;}
+		
 		// compute frame func
 		void compute_FRAME(void);
 		
+		// Radiance of pixels [x0, x1[ x [y0, y1[ into 3 planes at 'out', nothing else
+		// Each row restarts the generator from 'seed' and its position,
+		// so a tile always comes out the same whichever thread or process renders it
+		void compute_TILE(int x0, int y0, int x1, int y1, uint64_t seed, float* out);
+		
 		void refocus(void) {
+			accumulated = 0;
+			
 			w = normalized(eye_point - foc_point);
 			u = normalized(cross(camera_up, w));
 			v = cross(w, u);
@@ -137,32 +271,19 @@ class Camera {
 			eye_point += deltaU;
 		}
 		
-		void foc_forward(void) {
-			foc_point += vec3(0,0,-speed);
-		}
-		
-		void foc_rise(void) {
-			foc_point += vec3(0,speed,0);
-		}
-		
-		void foc_right(void) {
-			foc_point += vec3(speed,0,0);
+		Camera_Pose pose(void) const {
+			return {eye_point, foc_point, camera_up};
 		}
 		
-		void forward(void) {
-			eye_point += vec3(0,0,-speed);
-		}
-		
-		void rise(void) {
-			eye_point += vec3(0,speed,0);
-		}
-		
-		void right(void) {
-			eye_point += vec3(speed,0,0);
+		void set_pose(const Camera_Pose& p) {
+			eye_point = p.eye_point;
+			foc_point = p.foc_point;
+			camera_up = p.camera_up;
+			refocus();
 		}
 };
 
-ray Camera::get_ray(int x, int y) const {
+inline ray Camera::get_ray(int x, int y) const {
 	// Ray directed to pixel (x, y)
 	#ifdef SAMPLING_MODE
 		vec3 offset = vec3(get_rand_double()-.5, get_rand_double()-.5, 0);
@@ -174,6 +295,10 @@ ray Camera::get_ray(int x, int y) const {
 		point3 pixel_center = pixel_00
 							+ x * pixel_delta_h
 							+ y * pixel_delta_v;
+		
+		if(refine || temporal)
+			pixel_center += (get_rand_double()-.5) * pixel_delta_h
+						  + (get_rand_double()-.5) * pixel_delta_v;
 	#endif
 	
 	return ray(eye_point,					// Origin
@@ -182,50 +307,245 @@ ray Camera::get_ray(int x, int y) const {
 }
 
 
-color Camera::ray_color(const ray& r, int bounces_left) const {
+inline color Camera::ray_color(const ray& r, int bounces_left, aov_sample* aov) const {
 	if (bounces_left <= 0) return color(0);
 	
+	STAT(rays);
+	
 	hit_record rec;
 	
 	// No hits just yields the bg
 	if(!world.hit(r, interval::positive, rec))
 		return background;
 	
+	resolve_hit(r, rec);
+	
+	if(aov) {
+		aov->normal = rec.normal;
+		aov->depth  = rec.t * r.direction().len();
+	}
+	
 	ray scattered;
 	color attenuation;
-	color emit = rec.mat->emitted(rec.u, rec.v, rec.p);
+	color emit = shade_emitted(rec.mat, rec);
 	
 	// No scatter is just up to emission
-	if(!rec.mat->scatter(r, rec, attenuation, scattered))
+	if(!shade_scatter(rec.mat, r, rec, attenuation, scattered))
 		return emit;
 	
+	if(aov) aov->albedo = attenuation;
+	
+	STAT(bounces);
 	color scatter = attenuation * ray_color(scattered, bounces_left-1);
 	
 	return emit + scatter;
 }
 
 
-void Camera::compute_FRAME(void) {
+inline color Camera::render_PIXEL(int x, int y, aov_sample& aov) const {
+	#ifdef SAMPLING_MODE
+		color pixel_color(0);
+		aov.albedo = color(0);
+		for(int sample = 0; sample < samples_per_pixel; sample++) {
+			aov_sample sample_aov;
+			ray r = get_ray(x, y);
+			STAT(paths);
+			pixel_color += ray_color(r, max_bounces, &sample_aov);
+			
+			aov.albedo += sample_aov.albedo;
+			aov.normal += sample_aov.normal;
+			aov.depth  += sample_aov.depth;
+		}
+		
+		pixel_color *= pixel_samples_scale;
+		aov.albedo *= pixel_samples_scale;
+		aov.normal *= pixel_samples_scale;
+		aov.depth  *= pixel_samples_scale;
+		return pixel_color;
+	#else
+		ray r = get_ray(x, y);
+		STAT(paths);
+		return ray_color(r, max_bounces, &aov);
+	#endif
+}
+
+
+inline void Camera::compute_TILE(int x0, int y0, int x1, int y1, uint64_t seed, float* out) {
+	#ifdef SAMPLING_MODE
+		pixel_samples_scale = 1. / samples_per_pixel;
+	#endif
 	
-	#pragma omp parallel for
-	for(int y = 0; y < WIN_HEIGHT; y++) {
-		for(int x = 0; x < WIN_WIDTH; x++){
-			#ifdef SAMPLING_MODE
-				color pixel_color(0);
-				for(int sample = 0; sample < samples_per_pixel; sample++) {
-					ray r = get_ray(x, y);
-					pixel_color += ray_color(r, max_bounces);
+	const int tile_width = x1 - x0;
+	const size_t tile_size = size_t(tile_width) * (y1 - y0);
+	
+	#pragma omp parallel for schedule(dynamic)
+	for(int y = y0; y < y1; y++) {
+		seed_rand(seed ^ (uint64_t(uint32_t(y)) << 32 | uint32_t(x0)));
+		
+		for(int x = x0; x < x1; x++) {
+			aov_sample aov;
+			color pixel_color = render_PIXEL(x, y, aov);
+			
+			const size_t i = size_t(y - y0) * tile_width + (x - x0);
+			for(int c = 0; c < 3; c++)
+				out[c * tile_size + i] = pixel_color[c];
+		}
+	}
+}
+
+
+inline void Camera::compute_FRAME(void) {
+	
+	float* out_r = frame_buffer.plane(0);
+	float* out_g = frame_buffer.plane(1);
+	float* out_b = frame_buffer.plane(2);
+	
+	#ifdef STATS_MODE
+		stats = frame_stats();
+	#endif
+	#ifdef SAMPLING_MODE
+		pixel_samples_scale = 1. / samples_per_pixel;
+	#endif
+	
+	#pragma omp parallel
+	{
+		#ifdef STATS_MODE
+			thread_stats = frame_stats();
+		#endif
+		
+		#pragma omp for
+		for(int y = 0; y < WIN_HEIGHT; y++) {
+			for(int x = 0; x < WIN_WIDTH; x++){
+				#ifdef STATS_MODE
+					const uint64_t cost_before = thread_stats.cost();
+				#endif
+				
+				aov_sample aov;
+				color pixel_color = render_PIXEL(x, y, aov);
+				
+				const size_t i = size_t(y) * WIN_WIDTH + x;
+				out_r[i] = pixel_color.x();
+				out_g[i] = pixel_color.y();
+				out_b[i] = pixel_color.z();
+				
+				for(int c = 0; c < 3; c++) {
+					aov_buffer.plane(AOV_ALBEDO_R + c)[i] = aov.albedo[c];
+					aov_buffer.plane(AOV_NORMAL_X + c)[i] = aov.normal[c];
 				}
+				aov_buffer.plane(AOV_DEPTH)[i] = aov.depth;
 				
-				pixel_color *= pixel_samples_scale;
-			#else
-				ray r = get_ray(x, y);
-				color pixel_color = ray_color(r, max_bounces);
-			#endif
+				#ifdef STATS_MODE
+					cost_buffer.plane(0)[i] = thread_stats.cost() - cost_before;
+				#endif
+			}
+		}
+		
+		// Thread counters are merged once the frame is done
+		#ifdef STATS_MODE
+			#pragma omp critical
+			stats.merge(thread_stats);
+		#endif
+	}
+	
+	if(temporal) {
+		accumulated++;
+		reproject();
+	} else if(refine) {
+		accumulated++;
+		const bool first = accumulated == 1;
+		const float weight = 1.f / accumulated;
+		float* acc = accum_buffer.data.data();
+		float* cur = frame_buffer.data.data();
+		
+		#pragma omp parallel for
+		for(size_t i = 0; i < accum_buffer.data.size(); i++) {
+			acc[i] = first ? cur[i] : acc[i] + cur[i];
+			cur[i] = acc[i] * weight;
+		}
+	} else accumulated = 0;
+	
+	if(denoise)
+		denoiser.run(frame_buffer, aov_buffer);
+	
+	// The buffer may have been handed over and replaced
+	display_buffer.resize(WIN_SIZE);
+	
+	resolver.run(frame_buffer, display_buffer.data());
+}
+
+inline void Camera::reproject(void) {
+	if(next_history.width != WIN_WIDTH || next_history.height != WIN_HEIGHT)
+		next_history.resize(WIN_WIDTH, WIN_HEIGHT, HIST_CHANNELS);
+	
+	float* out[3] = {frame_buffer.plane(0), frame_buffer.plane(1), frame_buffer.plane(2)};
+	const float* depth = aov_buffer.plane(AOV_DEPTH);
+	
+	const View& prev = history_view;
+	const double inv_h = 1. / prev.delta_h.len_sqr();
+	const double inv_v = 1. / prev.delta_v.len_sqr();
+	const float max_count = refine ? std::numeric_limits<float>::max() : float(temporal_frames);
+	
+	#pragma omp parallel for
+	for(int y = 0; y < WIN_HEIGHT; y++) {
+		for(int x = 0; x < WIN_WIDTH; x++) {
+			const size_t i = size_t(y) * WIN_WIDTH + x;
+			
+			color c(out[0][i], out[1][i], out[2][i]);
+			float count = 0;
+			point3 p(0);
+			vec3 n(0);
+			
+			if(depth[i] > 0) {
+				count = 1;
+				p = eye_point + depth[i] * normalized(pixel_00 + x * pixel_delta_h + y * pixel_delta_v - eye_point);
+				for(int a = 0; a < 3; a++)
+					n[a] = aov_buffer.plane(AOV_NORMAL_X + a)[i];
+				if(!n.near_null()) n = normalized(n);
+			}
+			
+			// Pixel of the previous view that saw 'p'
+			const vec3 d = p - prev.eye;
+			const double dist = dot(d, prev.forward);
+			if(count > 0 && history_valid && dist > 0) {
+				const vec3 q = d * (prev.focal_length / dist) + prev.eye - prev.pixel_00;
+				const int px = int(std::floor(dot(q, prev.delta_h) * inv_h + .5));
+				const int py = int(std::floor(dot(q, prev.delta_v) * inv_v + .5));
 				
-			display_buffer[y * WIN_WIDTH + x] = get_color(pixel_color);
+				if(px >= 0 && px < prev.width && py >= 0 && py < prev.height) {
+					const size_t j = size_t(py) * prev.width + px;
+					const float prev_count = history.plane(HIST_COUNT)[j];
+					
+					point3 hp;
+					vec3 hn;
+					for(int a = 0; a < 3; a++) {
+						hp[a] = history.plane(HIST_PX + a)[j];
+						hn[a] = history.plane(HIST_NX + a)[j];
+					}
+					
+					if(prev_count > 0
+						&& std::fabs(dot(hp - p, n)) <= plane_tolerance * depth[i]
+						&& dot(hn, n) >= normal_tolerance) {
+						
+						count = std::min(prev_count + 1, max_count);
+						const color h(history.plane(HIST_R)[j], history.plane(HIST_G)[j], history.plane(HIST_B)[j]);
+						c = h + (c - h) / count;
+					}
+				}
+			}
+			
+			for(int a = 0; a < 3; a++) {
+				out[a][i] = c[a];
+				next_history.plane(HIST_R + a)[i] = c[a];
+				next_history.plane(HIST_PX + a)[i] = p[a];
+				next_history.plane(HIST_NX + a)[i] = n[a];
+			}
+			next_history.plane(HIST_COUNT)[i] = count;
 		}
 	}
+	
+	std::swap(history, next_history);
+	history_view = {eye_point, pixel_00, pixel_delta_h, pixel_delta_v, -w, focal_length, WIN_WIDTH, WIN_HEIGHT};
+	history_valid = true;
 }
 
 #endif
\ No newline at end of file
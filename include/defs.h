@@ -8,5 +8,8 @@
 #include "defs/texture.h"
 #include "defs/material.h"
 #include "defs/shapes.h"
+#include "defs/mesh.h"
+#include "defs/instance.h"
+#include "defs/volume.h"
 
 #endif
\ No newline at end of file
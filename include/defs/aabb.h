@@ -72,6 +72,12 @@ class AABB {
 			return true;
 		}
 		
+		double surface_area() const {
+			double dx = x_i.size(), dy = y_i.size(), dz = z_i.size();
+			if(dx < 0 || dy < 0 || dz < 0) return 0;
+			return 2 * (dx*dy + dy*dz + dz*dx);
+		}
+		
 		int longest_axis() const {
 			if(x_i.size() > y_i.size())
 				return x_i.size() > z_i.size() ? 0 : 2;
@@ -81,9 +87,14 @@ class AABB {
 		static const AABB empty, universe;
 };
 
-const AABB AABB::empty    = AABB(interval::empty);
-const AABB AABB::universe = AABB(interval::universe);
-
+// Common part of two boxes, empty if they do not overlap
+static inline AABB aabb_intersection(const AABB& a, const AABB& b) {
+	AABB r;
+	r.x_i = interval(std::max(a.x_i.min, b.x_i.min), std::min(a.x_i.max, b.x_i.max));
+	r.y_i = interval(std::max(a.y_i.min, b.y_i.min), std::min(a.y_i.max, b.y_i.max));
+	r.z_i = interval(std::max(a.z_i.min, b.z_i.min), std::min(a.z_i.max, b.z_i.max));
+	return r;
+}
 
 static inline point3 aabb_centroid(const AABB& a) {
 	return 0.5 * point3(
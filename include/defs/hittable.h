@@ -9,9 +9,15 @@ using std::make_shared;
 
 #include "utils.h"
 #include "aabb.h"
+#include "serialize.h"
 
 class IMaterial;
+class IHittable;
 
+// Hits are resolved in two phases:
+// traversal only fills 't', 'prim' and the primitive-local data below,
+// the surface interaction (p, normal, uv, mat) is then built once
+// for the closest hit through 'resolve_hit'.
 class hit_record {
 	public:
 		point3 p;
@@ -23,12 +29,44 @@ class hit_record {
 		double u;
 		double v;
 		
-		shared_ptr<IMaterial> mat;
+		const IMaterial* mat;
+		
+		// Phase one: closest primitive so far,
+		// its sub-primitive index and barycentrics
+		const IHittable* prim = nullptr;
+		uint32_t prim_id;
+		double b1, b2;
+		
+		// Primitive hit inside an instance, 'prim' is then the instance
+		const IHittable* inner = nullptr;
+		
+		// Bound on the absolute error of 'p' per axis, and the normal of the
+		// actual surface ('normal' may be a shading normal), see spawn_ray()
+		vec3 p_error;
+		vec3 geo_normal;
 		
 		// 'ext_normal' is assumed normalized
 		void set_face_normal(const ray& r, const vec3& ext_normal) {
 			is_front = dot(r.direction(), ext_normal) < 0;
 			normal = is_front ? ext_normal : -ext_normal;
+			geo_normal = normal;
+		}
+		
+		// Ray leaving the surface at 'p'
+		// Its origin is pushed along the normal just past the error of 'p', on the
+		// side 'dir' leaves through, so it cannot hit the same surface again
+		// and needs no epsilon on the distances it accepts
+		ray spawn_ray(const vec3& dir, double time) const {
+			vec3 offset = dot(abs(geo_normal), p_error) * geo_normal;
+			if(dot(dir, geo_normal) < 0) offset = -offset;
+			
+			// Rounded away from 'p', the sum may round back onto it
+			point3 origin = p + offset;
+			for(int a = 0; a < 3; a++) {
+				if(offset[a] > 0)	   origin[a] = std::nextafter(origin[a], inf);
+				else if(offset[a] < 0) origin[a] = std::nextafter(origin[a], -inf);
+			}
+			return ray(origin, dir, time);
 		}
 };
 
@@ -36,11 +74,48 @@ class IHittable {
 	public:
 		virtual ~IHittable() = default;
 		
+		// Phase one: only writes 'rec' on a hit closer than ray_t.max
 		virtual bool hit(const ray& r, interval ray_t, hit_record& rec) const = 0;
 		
+		// Phase two: fills the surface interaction of a hit this primitive recorded
+		// Aggregates never end up in 'rec.prim', hence the empty default
+		virtual void get_surface(const ray& r, hit_record& rec) const {}
+		
 		virtual AABB bounding_box() const = 0;
+		
+		// Bounds at shutter time 'time' (0 to 1), for motion BVHs, which
+		// interpolate them; only linearly moving primitives narrow them
+		virtual AABB time_bounds(double time) const {return bounding_box();}
+		
+		// Entry and exit distances of 'r' through a closed boundary, over the whole line
+		// Runs two hits by default, shapes that solve both at once override it:
+		// the exit is searched on a ray spawned past the entry's error bound,
+		// with the same direction so distances add up
+		virtual bool hit_span(const ray& r, interval& span) const {
+			hit_record rec1, rec2;
+			if(!hit(r, interval::universe, rec1)) return false;
+			
+			rec1.prim -> get_surface(r, rec1);
+			if(!hit(rec1.spawn_ray(r.direction(), r.time()), interval::positive, rec2)) return false;
+			span = interval(rec1.t, rec1.t + rec2.t);
+			return true;
+		}
+		
+		// Bounds of the part inside 'box', used by spatial splits
+		// Returns false if the primitive must not be referenced more than once
+		virtual bool clip_bounds(const AABB& box, AABB& clipped) const {
+			clipped = aabb_intersection(bounding_box(), box);
+			return true;
+		}
+		
+		// Record index in 'w', Scene_Writer::none if the type has no record
+		virtual uint32_t serialize(Scene_Writer& w) const {return Scene_Writer::none;}
 };
 
+inline void resolve_hit(const ray& r, hit_record& rec) {
+	rec.prim -> get_surface(r, rec);
+}
+
 
 // Shared pointers allow multiple geometries to share a common instance (i.e. multiple spheres, same material)
 
@@ -62,17 +137,23 @@ class hittable_list : public IHittable {
 		
 		AABB bounding_box() const override {return bbox;}
 		
+		AABB time_bounds(double time) const override {
+			AABB box = AABB::empty;
+			for(const auto& obj : objects)
+				box = AABB(box, obj -> time_bounds(time));
+			return box;
+		}
+		
 		bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
 			
-			hit_record temp_rec;
 			bool got_hit = false;
-			double closest = ray_t.max;
 			
+			// Hits only write 't' and the primitive id,
+			// so 'rec' can be shrunk in place
 			for(const auto& obj : objects){
-				if(obj -> hit(r, interval(ray_t.min, closest), temp_rec)) {
+				if(obj -> hit(r, ray_t, rec)) {
 					got_hit = true;
-					closest = temp_rec.t;
-					rec = temp_rec;
+					ray_t.max = rec.t;
 				}
 			}
 			
@@ -0,0 +1,141 @@
+#ifndef INSTANCE_H
+#define INSTANCE_H
+
+#include "utils.h"
+#include "defs/hittable.h"
+
+// Transformed reference to a shared BLAS (any IHittable, usually an LBVH or a mesh)
+// Rays go to object space for traversal, normals come back through the
+// transpose of the world-to-object transform, and hit points (with their
+// error bound) through the object-to-world one.
+// Instances are meant to sit in a TLAS, one level deep.
+class Instance : public IHittable {
+	private:
+		shared_ptr<IHittable> blas;
+		affine object_to_world, world_to_object;
+		AABB bbox;
+		
+		ray to_object(const ray& r) const {
+			return ray(world_to_object.point(r.origin()),
+						world_to_object.vector(r.direction()),
+						r.time());
+		}
+	
+	public:
+		Instance(shared_ptr<IHittable> blas, const affine& object_to_world) : blas(blas) {
+			set_transform(object_to_world);
+		}
+		
+		// Moving an instance only invalidates the TLAS above it
+		void set_transform(const affine& object_to_world) {
+			this->object_to_world = object_to_world;
+			world_to_object = object_to_world.inverse();
+			
+			// World bounds from the 8 transformed corners
+			const AABB box = blas -> bounding_box();
+			bbox = AABB::empty;
+			for(int i = 0; i < 8; i++) {
+				point3 corner(
+					(i & 1) ? box.x_i.max : box.x_i.min,
+					(i & 2) ? box.y_i.max : box.y_i.min,
+					(i & 4) ? box.z_i.max : box.z_i.min
+				);
+				point3 p = object_to_world.point(corner);
+				bbox = AABB(bbox, AABB(p, p));
+			}
+		}
+		
+		AABB bounding_box() const override {return bbox;}
+		
+		// The ray direction is not renormalized, so 't' is the same in both spaces
+		bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+			if(!blas -> hit(to_object(r), ray_t, rec)) return false;
+			
+			rec.inner = rec.prim;
+			rec.prim = this;
+			return true;
+		}
+		
+		void get_surface(const ray& r, hit_record& rec) const override {
+			rec.inner -> get_surface(to_object(r), rec);
+			
+			// Error of the object-space point, carried through the transform,
+			// plus the rounding of the transform itself
+			const auto& m = object_to_world.m;
+			vec3 error;
+			for(int i = 0; i < 3; i++) {
+				double carried = 0, rounding = std::fabs(m[i][3]);
+				for(int j = 0; j < 3; j++) {
+					carried  += std::fabs(m[i][j]) * rec.p_error[j];
+					rounding += std::fabs(m[i][j] * rec.p[j]);
+				}
+				error[i] = (1 + gamma_n<double>(3)) * carried + gamma_n<double>(3) * rounding;
+			}
+			rec.p = object_to_world.point(rec.p);
+			rec.p_error = error;
+			
+			// Facing is invariant under the transform, only the normals move
+			rec.normal = normalized(world_to_object.normal_from_inverse(rec.normal));
+			rec.geo_normal = normalized(world_to_object.normal_from_inverse(rec.geo_normal));
+		}
+};
+
+// Primitive moved along a keyframed path, one level deep like Instance
+// set_shutter() places it at the opening and closing of a frame's shutter,
+// rays in between (time 0 to 1) see it interpolated, so it comes out motion
+// blurred like a moving sphere. The BVH above it needs a refit() after each call.
+class Animated : public IHittable {
+	private:
+		shared_ptr<IHittable> object;
+		Track<vec3> path;			// Offset over time, in seconds
+		vec3 offset_0, offset_1;
+		AABB bbox;
+		
+		ray to_object(const ray& r) const {
+			return ray(r.origin() - (offset_0 + r.time() * (offset_1 - offset_0)),
+						r.direction(),
+						r.time());
+		}
+		
+		static AABB moved(const AABB& box, const vec3& offset) {
+			return AABB(point3(box.x_i.min, box.y_i.min, box.z_i.min) + offset,
+						point3(box.x_i.max, box.y_i.max, box.z_i.max) + offset);
+		}
+	
+	public:
+		Animated(shared_ptr<IHittable> object, const Track<vec3>& path) : object(object), path(path) {
+			set_shutter(0, 0);
+		}
+		
+		// Times in seconds
+		void set_shutter(double open, double close) {
+			offset_0 = path.at(open);
+			offset_1 = path.at(close);
+			
+			const AABB box = object -> bounding_box();
+			bbox = AABB(moved(box, offset_0), moved(box, offset_1));
+		}
+		
+		AABB bounding_box() const override {return bbox;}
+		
+		AABB time_bounds(double time) const override {
+			return moved(object -> time_bounds(time), offset_0 + time * (offset_1 - offset_0));
+		}
+		
+		bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+			if(!object -> hit(to_object(r), ray_t, rec)) return false;
+			
+			rec.inner = rec.prim;
+			rec.prim = this;
+			return true;
+		}
+		
+		// Translation only, the normals are unchanged
+		void get_surface(const ray& r, hit_record& rec) const override {
+			rec.inner -> get_surface(to_object(r), rec);
+			rec.p = rec.p + (offset_0 + r.time() * (offset_1 - offset_0));
+			rec.p_error = rec.p_error + gamma_n<double>(1) * abs(rec.p);
+		}
+};
+
+#endif
\ No newline at end of file
@@ -2,14 +2,92 @@
 #define MATERIAL_H
 
 #include "hittable.h"
+#include "texture.h"
+
+// Flat form of a material: its type and parameters, so the built-in materials
+// shade through a switch (shade_emitted, shade_scatter) with inlined code
+// instead of virtual calls. MAT_CUSTOM falls back to the virtual interface.
+struct Flat_Material {
+	uint32_t		type	= MAT_CUSTOM;
+	Texture_Program tex;					// Compiled texture, constant-folded
+	color			albedo	= color(0);		// Metal albedo
+	double			param	= 0;			// Metal fuzz, Dielectric refraction index
+	
+	// The program points into 't', which the material keeps
+	void set_texture(const shared_ptr<ITexture>& t) {
+		tex = Texture_Program(*t);
+	}
+	
+	color texture(const hit_record& rec) const {
+		return tex.eval(rec.u, rec.v, rec.p);
+	}
+};
+
+// Scattering of the built-in materials,
+// shared by their virtual overrides and shade_scatter
+inline bool lambertian_scatter(const ray& r_in, const hit_record& rec, ray& scattered) {
+	vec3 scatter_dir = rec.normal + random_unit_hemisphere(rec.normal);
+	
+	// Handle degenerate scatter dirs
+	if(scatter_dir.near_null())
+		scatter_dir = rec.normal;
+	
+	scattered = rec.spawn_ray(scatter_dir, r_in.time());
+	return true;
+}
+
+inline bool metal_scatter(const ray& r_in, const hit_record& rec, double fuzz, ray& scattered) {
+	vec3 reflected = reflect(r_in.direction(), rec.normal);
+	reflected = normalized(reflected) + (fuzz * random_unit_vector());
+	
+	scattered = rec.spawn_ray(reflected, r_in.time());
+	return (dot(scattered.direction(), rec.normal) > 0);
+}
+
+// Schlik's approx.
+inline double schlick_reflectance(double cosine, double ri) {
+	auto r0 = (1-ri)/(1+ri);
+	r0 = r0*r0;
+	auto x = 1 - cosine;
+	auto x2 = x*x;
+	return r0 + (1-r0)*x2*x2*x;
+}
+
+inline bool dielectric_scatter(const ray& r_in, const hit_record& rec, double refraction_index, ray& scattered) {
+	double rri = rec.is_front ? (1./refraction_index) : refraction_index;
+	
+	vec3 unit_dir = normalized(r_in.direction());
+	
+	double cos_theta = std::fmin(dot(-unit_dir, rec.normal), 1.);
+	double sin_theta = std::sqrt(1. - cos_theta*cos_theta);
+	
+	
+	bool beyond_critical = (rri * sin_theta) > 1.;
+	beyond_critical |= schlick_reflectance(cos_theta, rri) > get_rand_double();
+	
+	vec3 dir = beyond_critical ? reflect(unit_dir, rec.normal) : refract(unit_dir, rec.normal, rri);
+	
+	scattered = rec.spawn_ray(dir, r_in.time());
+	return true;
+}
+
+inline bool isotropic_scatter(const ray& r_in, const hit_record& rec, ray& scattered) {
+	scattered = rec.spawn_ray(random_unit_vector(), r_in.time());
+	return true;
+}
 
 class IMaterial {
 	public:
+		// Set by the built-in materials, left to MAT_CUSTOM otherwise
+		Flat_Material flat;
+		
 		virtual ~IMaterial() = default;
 		
 		virtual color emitted(double u, double v, const point3& p) const {return color(0);}
 		
 		virtual bool scatter (const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered) const {return 0;}
+		
+		virtual uint32_t serialize(Scene_Writer& w) const {return Scene_Writer::none;}
 };
 
 class Lambertian : public IMaterial {
@@ -17,21 +95,23 @@ class Lambertian : public IMaterial {
 		shared_ptr<ITexture> tex;
 		
 	public:
-		Lambertian(const color& albedo) : tex(make_shared<Uniform_Color>(albedo)) {}
+		Lambertian(const color& albedo) : Lambertian(make_shared<Uniform_Color>(albedo)) {}
 		
-		Lambertian(shared_ptr<ITexture> tex) : tex(tex) {}
+		Lambertian(shared_ptr<ITexture> tex) : tex(tex) {
+			flat.type = MAT_LAMBERTIAN;
+			flat.set_texture(tex);
+		}
 		
 		bool scatter (const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered) const override {
-			vec3 scatter_dir = rec.normal + random_unit_hemisphere(rec.normal);
-			
-			// Handle degenerate scatter dirs
-			if(scatter_dir.near_null())
-				scatter_dir = rec.normal;
-			
-			scattered = ray(rec.p, scatter_dir, r_in.time());
 			attenuation = tex->value(rec.u, rec.v, rec.p);
-			
-			return true;
+			return lambertian_scatter(r_in, rec, scattered);
+		}
+		
+		uint32_t serialize(Scene_Writer& w) const override {
+			material_record rec = {};
+			rec.type = MAT_LAMBERTIAN;
+			rec.tex = w.add(tex.get());
+			return w.push(rec);
 		}
 };
 
@@ -41,16 +121,24 @@ class Metal : public IMaterial {
 		double fuzz;
 	
 	public:
-		Metal(const color& albedo, const double& fuzz) : albedo(albedo), fuzz((fuzz < 1) ? fuzz : 1) {}
+		Metal(const color& albedo, const double& fuzz) : albedo(albedo), fuzz((fuzz < 1) ? fuzz : 1) {
+			flat.type = MAT_METAL;
+			flat.albedo = albedo;
+			flat.param = this->fuzz;
+		}
 		
 		bool scatter (const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered) const override {
-			vec3 reflected = reflect(r_in.direction(), rec.normal);
-			reflected = normalized(reflected) + (fuzz * random_unit_vector());
-			
-			scattered = ray(rec.p, reflected, r_in.time());
 			attenuation = albedo;
-			
-			return (dot(scattered.direction(), rec.normal) > 0);
+			return metal_scatter(r_in, rec, fuzz, scattered);
+		}
+		
+		uint32_t serialize(Scene_Writer& w) const override {
+			material_record rec = {};
+			rec.type = MAT_METAL;
+			rec.tex = Scene_Writer::none;
+			rec.param = fuzz;
+			write_vec3(rec.albedo, albedo);
+			return w.push(rec);
 		}
 };
 
@@ -58,33 +146,23 @@ class Dielectric : public IMaterial {
 	private:
 		double refraction_index;
 		
-		// Schlik's approx.
-		static double reflectance(double cosine, double ri) {
-			auto r0 = (1-ri)/(1+ri);
-			r0 = r0*r0;
-			return r0 + (1-r0)*std::pow((1-cosine),5);
-		}
-		
 	public:
-		Dielectric(double refraction_index) : refraction_index(refraction_index) {}
+		Dielectric(double refraction_index) : refraction_index(refraction_index) {
+			flat.type = MAT_DIELECTRIC;
+			flat.param = refraction_index;
+		}
 		
 		bool scatter(const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered) const override {
 			attenuation = color(1);
-			double rri = rec.is_front ? (1./refraction_index) : refraction_index;
-			
-			vec3 unit_dir = normalized(r_in.direction());
-			
-			double cos_theta = std::fmin(dot(-unit_dir, rec.normal), 1.);
-			double sin_theta = std::sqrt(1. - cos_theta*cos_theta);
-			
-			
-			bool beyond_critical = (rri * sin_theta) > 1.;
-			beyond_critical |= reflectance(cos_theta, rri) > get_rand_double();
-			
-			vec3 dir = beyond_critical ? reflect(unit_dir, rec.normal) : refract(unit_dir, rec.normal, rri);
-			
-			scattered = ray(rec.p, dir, r_in.time());
-			return true;
+			return dielectric_scatter(r_in, rec, refraction_index, scattered);
+		}
+		
+		uint32_t serialize(Scene_Writer& w) const override {
+			material_record rec = {};
+			rec.type = MAT_DIELECTRIC;
+			rec.tex = Scene_Writer::none;
+			rec.param = refraction_index;
+			return w.push(rec);
 		}
 };
 
@@ -93,13 +171,23 @@ class Emitter : public IMaterial {
 		shared_ptr<ITexture> tex;
 		
 	public:
-		Emitter(shared_ptr<ITexture> tex) : tex(tex) {}
+		Emitter(shared_ptr<ITexture> tex) : tex(tex) {
+			flat.type = MAT_EMITTER;
+			flat.set_texture(tex);
+		}
 		
-		Emitter(const color& emit) : tex(make_shared<Uniform_Color>(emit)) {}
+		Emitter(const color& emit) : Emitter(make_shared<Uniform_Color>(emit)) {}
 		
 		color emitted(double u, double v, const point3& p) const override {
 			return tex -> value(u, v, p);
 		}
+		
+		uint32_t serialize(Scene_Writer& w) const override {
+			material_record rec = {};
+			rec.type = MAT_EMITTER;
+			rec.tex = w.add(tex.get());
+			return w.push(rec);
+		}
 };
 
 class Isotropic : public IMaterial {
@@ -107,15 +195,55 @@ class Isotropic : public IMaterial {
 		shared_ptr<ITexture> tex;
 	
 	public:
-		Isotropic(const color& albedo) : tex(make_shared<Uniform_Color>(albedo)) {}
+		Isotropic(const color& albedo) : Isotropic(make_shared<Uniform_Color>(albedo)) {}
 		
-		Isotropic(shared_ptr<ITexture> tex) : tex(tex) {}
+		Isotropic(shared_ptr<ITexture> tex) : tex(tex) {
+			flat.type = MAT_ISOTROPIC;
+			flat.set_texture(tex);
+		}
 		
 		bool scatter (const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered) const override {
-			scattered = ray(rec.p, random_unit_vector(), r_in.time());
 			attenuation = tex->value(rec.u, rec.v, rec.p);
-			return true;
+			return isotropic_scatter(r_in, rec, scattered);
+		}
+		
+		uint32_t serialize(Scene_Writer& w) const override {
+			material_record rec = {};
+			rec.type = MAT_ISOTROPIC;
+			rec.tex = w.add(tex.get());
+			return w.push(rec);
 		}
 };
 
+// Emission at 'rec', a compare for everything but emitters
+inline color shade_emitted(const IMaterial* mat, const hit_record& rec) {
+	const Flat_Material& m = mat -> flat;
+	if(m.type == MAT_EMITTER) return m.texture(rec);
+	if(m.type == MAT_CUSTOM)  return mat -> emitted(rec.u, rec.v, rec.p);
+	return color(0);
+}
+
+// Same as mat->scatter(), switching on the flat form
+inline bool shade_scatter(const IMaterial* mat, const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered) {
+	const Flat_Material& m = mat -> flat;
+	switch(m.type) {
+		case MAT_LAMBERTIAN:
+			attenuation = m.texture(rec);
+			return lambertian_scatter(r_in, rec, scattered);
+		case MAT_METAL:
+			attenuation = m.albedo;
+			return metal_scatter(r_in, rec, m.param, scattered);
+		case MAT_DIELECTRIC:
+			attenuation = color(1);
+			return dielectric_scatter(r_in, rec, m.param, scattered);
+		case MAT_ISOTROPIC:
+			attenuation = m.texture(rec);
+			return isotropic_scatter(r_in, rec, scattered);
+		case MAT_EMITTER:
+			return false;
+		default:
+			return mat -> scatter(r_in, rec, attenuation, scattered);
+	}
+}
+
 #endif
\ No newline at end of file
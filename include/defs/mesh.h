@@ -0,0 +1,352 @@
+#ifndef MESH_H
+#define MESH_H
+
+#include <algorithm>
+#include <atomic>
+#include <omp.h>
+
+#include "utils.h"
+#include "defs/hittable.h"
+
+// Flat buffers of an indexed triangle mesh
+// Normals and UVs are optional and indexed separately, as in OBJ files
+struct Mesh_Data {
+	std::vector<float>    positions;		// xyz per vertex
+	std::vector<float>    normals;			// xyz per normal
+	std::vector<float>    uvs;				// uv per texcoord
+	std::vector<uint32_t> indices;			// 3 vertex indices per triangle
+	std::vector<uint32_t> normal_indices;	// Empty, or 3 per triangle
+	std::vector<uint32_t> uv_indices;		// Empty, or 3 per triangle
+	
+	size_t triangle_count() const {return indices.size() / 3;}
+};
+
+// BLAS node of a mesh, 32 bytes
+// Children of an interior node are stored next to each other
+struct Mesh_node {
+	float 	 min[3];
+	float 	 max[3];
+	uint32_t first;	// Interior: left child, right is first+1 | Leaf: first triangle
+	uint32_t count;	// Triangles in the leaf, 0 for interior nodes
+};
+
+class Triangle_Mesh : public IHittable {
+	private:
+		static constexpr uint32_t leafThreshold = 4;
+		static constexpr uint32_t taskThreshold = 1 << 14;
+		
+		Mesh_Data mesh;
+		std::vector<Mesh_node> nodes;
+		shared_ptr<IMaterial> mat;
+		AABB bbox;
+		
+		// Build-time only
+		std::vector<uint32_t> tri_order;
+		std::vector<float> centroids;
+		std::atomic<uint32_t> node_count;
+		
+		vec3 vertex(uint32_t i) const {
+			const float* v = &mesh.positions[3*size_t(i)];
+			return vec3(v[0], v[1], v[2]);
+		}
+		
+		static void grow(Mesh_node& node, const float* v) {
+			for(int a = 0; a < 3; a++) {
+				node.min[a] = std::min(node.min[a], v[a]);
+				node.max[a] = std::max(node.max[a], v[a]);
+			}
+		}
+		
+		void build(uint32_t idx, uint32_t start, uint32_t end) {
+			Mesh_node& node = nodes[idx];
+			const uint32_t n = end - start;
+			
+			const float f_inf = std::numeric_limits<float>::infinity();
+			float cmin[3] = { f_inf,  f_inf,  f_inf};
+			float cmax[3] = {-f_inf, -f_inf, -f_inf};
+			for(uint32_t i = start; i < end; i++) {
+				const float* c = &centroids[3*size_t(tri_order[i])];
+				for(int a = 0; a < 3; a++) {
+					cmin[a] = std::min(cmin[a], c[a]);
+					cmax[a] = std::max(cmax[a], c[a]);
+				}
+			}
+			
+			int axis = 0;
+			for(int a = 1; a < 3; a++)
+				if(cmax[a] - cmin[a] > cmax[axis] - cmin[axis]) axis = a;
+			
+			if(n <= leafThreshold || cmax[axis] == cmin[axis]) {
+				node.first = start;
+				node.count = n;
+				for(int a = 0; a < 3; a++) {
+					node.min[a] =  f_inf;
+					node.max[a] = -f_inf;
+				}
+				for(uint32_t i = start; i < end; i++)
+					for(int k = 0; k < 3; k++)
+						grow(node, &mesh.positions[3*size_t(mesh.indices[3*size_t(tri_order[i]) + k])]);
+				return;
+			}
+			
+			// Median split, same as LBVH
+			uint32_t mid = start + n/2;
+			const float* cent = centroids.data();
+			std::nth_element(tri_order.begin() + start, tri_order.begin() + mid, tri_order.begin() + end,
+			[cent, axis](uint32_t a, uint32_t b) {
+				return cent[3*size_t(a) + axis] < cent[3*size_t(b) + axis];
+			});
+			
+			const uint32_t child = node_count.fetch_add(2);
+			node.first = child;
+			node.count = 0;
+			
+			if(n > taskThreshold) {
+				#pragma omp task
+				build(child, start, mid);
+				
+				build(child+1, mid, end);
+				
+				#pragma omp taskwait
+			} else {
+				build(child,   start, mid);
+				build(child+1, mid,   end);
+			}
+			
+			// Bounds come bottom-up, from the children
+			const Mesh_node& l = nodes[child];
+			const Mesh_node& r = nodes[child+1];
+			for(int a = 0; a < 3; a++) {
+				node.min[a] = std::min(l.min[a], r.min[a]);
+				node.max[a] = std::max(l.max[a], r.max[a]);
+			}
+		}
+		
+		// Slab test against a float node, entry distance in 't_near'
+		static bool box_hit(const Mesh_node& node, const point3& orig, const vec3& inv_dir, double t_max, double& t_near) {
+			double t0 = 0, t1 = t_max;
+			for(int a = 0; a < 3; a++) {
+				double ta = (node.min[a] - orig[a]) * inv_dir[a];
+				double tb = (node.max[a] - orig[a]) * inv_dir[a];
+				if(inv_dir[a] < 0) std::swap(ta, tb);
+				t0 = std::max(t0, ta);
+				t1 = std::min(t1, tb);
+			}
+			t_near = t0;
+			return t0 <= t1;
+		}
+		
+		// Möller-Trumbore
+		bool hit_triangle(uint32_t tri, const ray& r, const interval& ray_t, double& t, double& b1, double& b2) const {
+			const uint32_t* id = &mesh.indices[3*size_t(tri)];
+			const point3 v0 = vertex(id[0]);
+			const vec3 e1 = vertex(id[1]) - v0;
+			const vec3 e2 = vertex(id[2]) - v0;
+			
+			const vec3 pvec = cross(r.direction(), e2);
+			const double det = dot(e1, pvec);
+			if(det == 0.) return false;
+			
+			const double inv_det = 1. / det;
+			const vec3 tvec = r.origin() - v0;
+			b1 = dot(tvec, pvec) * inv_det;
+			if(b1 < 0. || b1 > 1.) return false;
+			
+			const vec3 qvec = cross(tvec, e1);
+			b2 = dot(r.direction(), qvec) * inv_det;
+			if(b2 < 0. || b1 + b2 > 1.) return false;
+			
+			t = dot(e2, qvec) * inv_det;
+			return ray_t.has_open(t);
+		}
+	
+	public:
+		Triangle_Mesh(Mesh_Data&& data, shared_ptr<IMaterial> mat) : mesh(std::move(data)), mat(mat), node_count(1) {
+			const uint32_t tri_count = mesh.triangle_count();
+			if(tri_count == 0) {
+				bbox = AABB::empty;
+				return;
+			}
+			
+			tri_order.resize(tri_count);
+			centroids.resize(3*size_t(tri_count));
+			
+			#pragma omp parallel for
+			for(uint32_t i = 0; i < tri_count; i++) {
+				tri_order[i] = i;
+				const uint32_t* id = &mesh.indices[3*size_t(i)];
+				for(int a = 0; a < 3; a++)
+					centroids[3*size_t(i) + a] = (mesh.positions[3*size_t(id[0]) + a]
+												+ mesh.positions[3*size_t(id[1]) + a]
+												+ mesh.positions[3*size_t(id[2]) + a]) * (1.f/3);
+			}
+			
+			nodes.resize(2*size_t(tri_count));
+			
+			#pragma omp parallel
+			{
+				#pragma omp single
+				{
+					build(0, 0, tri_count);
+				}
+			}
+			
+			nodes.resize(node_count.load());
+			nodes.shrink_to_fit();
+			
+			// Reorder triangles so leaves index contiguous ranges
+			auto permute = [this, tri_count](std::vector<uint32_t>& ids) {
+				if(ids.empty()) return;
+				std::vector<uint32_t> sorted(ids.size());
+				#pragma omp parallel for
+				for(uint32_t i = 0; i < tri_count; i++)
+					for(int k = 0; k < 3; k++)
+						sorted[3*size_t(i) + k] = ids[3*size_t(tri_order[i]) + k];
+				ids.swap(sorted);
+			};
+			permute(mesh.indices);
+			permute(mesh.normal_indices);
+			permute(mesh.uv_indices);
+			
+			std::vector<uint32_t>().swap(tri_order);
+			std::vector<float>().swap(centroids);
+			
+			const Mesh_node& root = nodes[0];
+			bbox = AABB(point3(root.min[0], root.min[1], root.min[2]),
+						point3(root.max[0], root.max[1], root.max[2]));
+		}
+		
+		size_t triangle_count() const {return mesh.triangle_count();}
+		size_t vertex_count()   const {return mesh.positions.size() / 3;}
+		
+		// Geometry and BLAS footprint
+		size_t memory_bytes() const {
+			return sizeof(float)    * (mesh.positions.size() + mesh.normals.size() + mesh.uvs.size())
+				 + sizeof(uint32_t) * (mesh.indices.size() + mesh.normal_indices.size() + mesh.uv_indices.size())
+				 + sizeof(Mesh_node) * nodes.size();
+		}
+		
+		AABB bounding_box() const override {return bbox;}
+		
+		bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+			if(nodes.empty()) return false;
+			
+			const point3& orig = r.origin();
+			const vec3 inv_dir(1. / r.direction().x(), 1. / r.direction().y(), 1. / r.direction().z());
+			
+			struct Entry {uint32_t idx; double t;};
+			Entry stack[64];
+			int sp = 0;
+			
+			double t_near;
+			STAT(aabb_tests);
+			if(!box_hit(nodes[0], orig, inv_dir, ray_t.max, t_near)) return false;
+			stack[sp++] = {0, t_near};
+			
+			bool got_hit = false;
+			
+			while(sp > 0) {
+				const Entry entry = stack[--sp];
+				if(entry.t > ray_t.max) continue;
+				
+				const Mesh_node* node = &nodes[entry.idx];
+				
+				// Walk down the nearest child, deferring the other one
+				while(node->count == 0) {
+					STAT(nodes);
+					STAT_ADD(aabb_tests, 2);
+					const uint32_t l = node->first;
+					double tl, tr;
+					bool hl = box_hit(nodes[l],   orig, inv_dir, ray_t.max, tl);
+					bool hr = box_hit(nodes[l+1], orig, inv_dir, ray_t.max, tr);
+					
+					if(hl && hr) {
+						if(tr < tl) {
+							stack[sp++] = {l, tl};
+							node = &nodes[l+1];
+						} else {
+							stack[sp++] = {l+1, tr};
+							node = &nodes[l];
+						}
+					} else if(hl) {
+						node = &nodes[l];
+					} else if(hr) {
+						node = &nodes[l+1];
+					} else {
+						node = nullptr;
+						break;
+					}
+				}
+				
+				if(!node) continue;
+				
+				STAT(nodes);
+				STAT_ADD(prim_tests, node->count);
+				for(uint32_t i = node->first; i < node->first + node->count; i++) {
+					double t, b1, b2;
+					if(hit_triangle(i, r, ray_t, t, b1, b2)) {
+						got_hit = true;
+						ray_t.max = t;
+						
+						rec.t = t;
+						rec.prim = this;
+						rec.prim_id = i;
+						rec.b1 = b1;
+						rec.b2 = b2;
+					}
+				}
+			}
+			
+			return got_hit;
+		}
+		
+		void get_surface(const ray& r, hit_record& rec) const override {
+			const size_t tri = 3*size_t(rec.prim_id);
+			const double b0 = 1. - rec.b1 - rec.b2;
+			
+			const point3 v0 = vertex(mesh.indices[tri]);
+			const point3 v1 = vertex(mesh.indices[tri+1]);
+			const point3 v2 = vertex(mesh.indices[tri+2]);
+			const vec3 geo_normal = normalized(cross(v1 - v0, v2 - v0));
+			
+			// Rebuilt from the barycentrics rather than along the ray
+			const vec3 p0 = b0 * v0, p1 = rec.b1 * v1, p2 = rec.b2 * v2;
+			rec.p = p0 + p1 + p2;
+			rec.p_error = gamma_n<double>(7) * (abs(p0) + abs(p1) + abs(p2));
+			rec.set_face_normal(r, geo_normal);
+			
+			// Interpolated shading normal, on the side the ray sees
+			if(!mesh.normal_indices.empty()) {
+				vec3 n(0);
+				const double b[3] = {b0, rec.b1, rec.b2};
+				for(int k = 0; k < 3; k++) {
+					const float* nk = &mesh.normals[3*size_t(mesh.normal_indices[tri+k])];
+					n += b[k] * vec3(nk[0], nk[1], nk[2]);
+				}
+				
+				if(!n.near_null()) {
+					n = normalized(n);
+					rec.normal = (dot(n, rec.normal) < 0) ? -n : n;
+				}
+			}
+			
+			if(!mesh.uv_indices.empty()) {
+				const float* t0 = &mesh.uvs[2*size_t(mesh.uv_indices[tri])];
+				const float* t1 = &mesh.uvs[2*size_t(mesh.uv_indices[tri+1])];
+				const float* t2 = &mesh.uvs[2*size_t(mesh.uv_indices[tri+2])];
+				rec.u = b0*t0[0] + rec.b1*t1[0] + rec.b2*t2[0];
+				rec.v = b0*t0[1] + rec.b1*t1[1] + rec.b2*t2[1];
+			} else {
+				rec.u = rec.b1;
+				rec.v = rec.b2;
+			}
+			
+			rec.mat = mat.get();
+		}
+};
+
+// Defined in obj_loader.cpp
+// Returns nullptr if the file cannot be read or references missing vertices
+shared_ptr<Triangle_Mesh> load_OBJ(const char* filename, shared_ptr<IMaterial> mat);
+
+#endif
\ No newline at end of file
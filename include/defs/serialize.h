@@ -0,0 +1,106 @@
+#ifndef SERIALIZE_H
+#define SERIALIZE_H
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "utils.h"
+
+class ITexture;
+class IMaterial;
+class IHittable;
+
+// Flat POD records describing a scene
+// Children always get a lower index than their parent,
+// so tables can be rebuilt front to back.
+
+enum Texture_Type : uint32_t {TEX_UNIFORM, TEX_CHECKER, TEX_LOLLIPOP, TEX_IMAGE};
+
+struct texture_record {
+	uint32_t type;
+	uint32_t even, odd;		// Child textures
+	uint32_t name;			// Offset of the image filename in the names blob
+	double	 scale;
+	double	 albedo[3];
+};
+
+// MAT_CUSTOM only tags materials without a flat form, it has no record
+enum Material_Type : uint32_t {MAT_LAMBERTIAN, MAT_METAL, MAT_DIELECTRIC, MAT_EMITTER, MAT_ISOTROPIC, MAT_CUSTOM};
+
+struct material_record {
+	uint32_t type;
+	uint32_t tex;
+	double	 param;			// Fuzz or refraction index
+	double	 albedo[3];
+};
+
+enum Primitive_Type : uint32_t {PRIM_SPHERE, PRIM_QUAD, PRIM_CONSTANT_MEDIUM};
+
+struct primitive_record {
+	uint32_t type;
+	uint32_t mat;
+	uint32_t boundary;		// Media only
+	uint32_t pad;
+	double	 data[10];		// Shape parameters, see each serialize()
+};
+
+// Collects the records of a scene, sharing objects met several times
+class Scene_Writer {
+	private:
+		std::unordered_map<const void*, uint32_t> ids;
+	
+	public:
+		static constexpr uint32_t none = 0xFFFFFFFFu;
+		
+		std::vector<texture_record>   textures;
+		std::vector<material_record>  materials;
+		std::vector<primitive_record> primitives;
+		std::vector<uint32_t>		  roots;		// Top-level primitives, in scene order
+		std::string					  names;
+		
+		// Cleared when an object has no record type
+		bool complete = true;
+		
+		// Defined in scene_cache.cpp
+		uint32_t add(const ITexture* tex);
+		uint32_t add(const IMaterial* mat);
+		uint32_t add(const IHittable* obj);
+		
+		uint32_t push(const texture_record& rec) {
+			textures.push_back(rec);
+			return textures.size() - 1;
+		}
+		
+		uint32_t push(const material_record& rec) {
+			materials.push_back(rec);
+			return materials.size() - 1;
+		}
+		
+		uint32_t push(const primitive_record& rec) {
+			primitives.push_back(rec);
+			return primitives.size() - 1;
+		}
+		
+		uint32_t push_name(const std::string& name) {
+			uint32_t offset = names.size();
+			names += name;
+			names += '\0';
+			return offset;
+		}
+		
+		// FNV-1a over every table
+		uint64_t hash() const;
+};
+
+static inline void write_vec3(double* out, const vec3& v) {
+	out[0] = v[0];
+	out[1] = v[1];
+	out[2] = v[2];
+}
+
+static inline vec3 read_vec3(const double* in) {
+	return vec3(in[0], in[1], in[2]);
+}
+
+#endif
\ No newline at end of file
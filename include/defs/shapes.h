@@ -38,7 +38,7 @@ class Quad : public IHittable {
 		
 			auto t = (d - dot(normal, r.origin())) / denom;
 			
-			if(!ray_t.has_closed(t)) return false;
+			if(!ray_t.has_open(t)) return false;
 			
 			point3 intersection = r.at(t);
 			vec3 p = intersection - Q;
@@ -49,17 +49,81 @@ class Quad : public IHittable {
 				|| !interval::unit.has_closed(beta))
 				return false;
 			
-			rec.u = alpha;
-			rec.v = beta;
+			rec.t = t;
+			rec.prim = this;
+			rec.b1 = alpha;
+			rec.b2 = beta;
+			
+			return true;
+		}
+		
+		// Polygon clipped against the six planes of 'box' (Sutherland-Hodgman)
+		bool clip_bounds(const AABB& box, AABB& clipped) const override {
+			point3 poly[10] = {Q, Q+u, Q+u+v, Q+v};
+			int n = 4;
 			
+			for(int a = 0; a < 3 && n > 0; a++) {
+				for(int side = 0; side < 2 && n > 0; side++) {
+					const double plane = side ? box.axis_interval(a).max : box.axis_interval(a).min;
+					auto inside = [a, side, plane](const point3& p) {
+						return side ? p[a] <= plane : p[a] >= plane;
+					};
+					
+					point3 out[10];
+					int m = 0;
+					for(int i = 0; i < n; i++) {
+						const point3& cur = poly[i];
+						const point3& next = poly[(i+1) % n];
+						if(inside(cur)) out[m++] = cur;
+						if(inside(cur) != inside(next)) {
+							point3 p = cur + (plane - cur[a]) / (next[a] - cur[a]) * (next - cur);
+							p[a] = plane;
+							out[m++] = p;
+						}
+					}
+					std::copy(out, out + m, poly);
+					n = m;
+				}
+			}
 			
-			rec.t = t;
-			rec.p = intersection;
-			rec.mat = mat;
-			rec.set_face_normal(r, normal);
+			if(n == 0) {
+				clipped = AABB::empty;
+				return true;
+			}
+			
+			interval axes[3];
+			for(int i = 0; i < n; i++)
+				for(int a = 0; a < 3; a++)
+					axes[a] = interval(axes[a], interval(poly[i][a], poly[i][a]));
 			
+			// Widened for rounding in the intersections, padded like the full box
+			clipped = AABB(axes[0].expand(1e-9), axes[1].expand(1e-9), axes[2].expand(1e-9));
 			return true;
 		}
+		
+		// The point is rebuilt from the quad's own frame rather than along the ray,
+		// so its error does not grow with the distance travelled
+		void get_surface(const ray& r, hit_record& rec) const override {
+			const vec3 along_u = rec.b1 * u;
+			const vec3 along_v = rec.b2 * v;
+			rec.p = Q + along_u + along_v;
+			rec.p_error = gamma_n<double>(7) * (abs(Q) + abs(along_u) + abs(along_v));
+			rec.u = rec.b1;
+			rec.v = rec.b2;
+			rec.mat = mat.get();
+			rec.set_face_normal(r, normal);
+		}
+		
+		// Q, u, v
+		uint32_t serialize(Scene_Writer& w) const override {
+			primitive_record rec = {};
+			rec.type = PRIM_QUAD;
+			rec.mat = w.add(mat.get());
+			write_vec3(rec.data,     Q);
+			write_vec3(rec.data + 3, u);
+			write_vec3(rec.data + 6, v);
+			return w.push(rec);
+		}
 };
 
 
@@ -77,8 +141,8 @@ class Sphere : public IHittable {
 			// u angle around Y axis from -X
 			// v angle from -Y to +Y
 			
-			auto theta = std::acos(-p.y());
-			auto phi   = std::atan2(-p.z(), p.x()) + PI;
+			auto theta = fast_acos(-p.y());
+			auto phi   = fast_atan2(-p.z(), p.x()) + PI;
 			
 			u = phi / TWO_PI;
 			v = theta / PI;
@@ -86,13 +150,13 @@ class Sphere : public IHittable {
 	
 	public:
 		// Static sphere
-		Sphere(const point3& c, float r, shared_ptr<IMaterial> mat) : center(c, vec3(0)), radius(std::fabsf(r)), mat(mat) {
+		Sphere(const point3& c, float r, shared_ptr<IMaterial> mat) : center(c, vec3(0)), radius(std::fabs(r)), mat(mat) {
 			vec3 r_vec = vec3(radius);
 			bbox = AABB(c - r_vec, c + r_vec);
 		}
 		
 		// Moving sphere
-		Sphere(const point3& c1, const point3& c2, float r, shared_ptr<IMaterial> mat) : center(c1, c2 - c1), radius(std::fabsf(r)), mat(mat) {
+		Sphere(const point3& c1, const point3& c2, float r, shared_ptr<IMaterial> mat) : center(c1, c2 - c1), radius(std::fabs(r)), mat(mat) {
 			vec3 r_vec = vec3(radius);
 			AABB box_0(center.at(0) - r_vec, center.at(0) + r_vec);
 			AABB box_1(center.at(1) - r_vec, center.at(1) + r_vec);
@@ -101,42 +165,118 @@ class Sphere : public IHittable {
 		
 		AABB bounding_box() const override {return bbox;}
 		
-		bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
-			point3 curr_center = center.at(r.time());
+		AABB time_bounds(double time) const override {
+			vec3 r_vec = vec3(radius);
+			return AABB(center.at(time) - r_vec, center.at(time) + r_vec);
+		}
+		
+		// Both roots of the quadratic, in increasing order
+		// b' is used because b is even. Each root comes from the form that does
+		// not subtract nearly equal terms, so the root of a ray leaving the
+		// surface stays near zero with the sign of its side.
+		bool solve(const ray& r, double& t0, double& t1) const {
+			const vec3 OC = center.at(r.time()) - r.origin();
+			const double R = radius;
 			
-			vec3 OC = curr_center - r.origin();
-	
-			// Solves quadratic equation for sphere
-			// b' is used because b is even
-			float a = r.direction().len_sqr();
-			float b_pr = dot(r.direction(), OC);
-			float c = OC.len_sqr() - radius * radius;
+			const double a = r.direction().len_sqr();
+			const double b_pr = dot(r.direction(), OC);
+			const double c = OC.len_sqr() - R * R;
 			
-			float del = (b_pr*b_pr - a*c);
+			const double del = b_pr*b_pr - a*c;
+			if(del < 0) return false;
 			
-			if(del < 0)
-				return false;
+			const double q = b_pr + std::copysign(std::sqrt(del), b_pr);
+			if(q == 0) return false;
 			
-			float sqrt_del = sqrt(del);
+			t0 = q / a;
+			t1 = c / q;
+			if(t0 > t1) std::swap(t0, t1);
+			return true;
+		}
+		
+		bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+			double t0, t1;
+			if(!solve(r, t0, t1)) return false;
 			
 			// Root within range
-			float t = (b_pr - sqrt_del) / a;
+			double t = t0;
 			if(!ray_t.has_open(t)) {
-				t = (b_pr + sqrt_del) / a;
+				t = t1;
 				
 				if(!ray_t.has_open(t))
 					return false;
 			}
 			
 			rec.t = t;
-			rec.p = r.at(t);
-			vec3 out_normal = (rec.p - curr_center) / radius;
-			rec.set_face_normal(r, out_normal);
-			get_uv(out_normal, rec.u, rec.v);
-			rec.mat = mat;
+			rec.prim = this;
+			
+			return true;
+		}
+		
+		// Both roots of the quadratic from one solve
+		bool hit_span(const ray& r, interval& span) const override {
+			double t0, t1;
+			if(!solve(r, t0, t1)) return false;
 			
+			span = interval(t0, t1);
 			return true;
 		}
+		
+		// Each slab of 'box' bounds the other two axes by the widest
+		// cross-section of the sphere inside it
+		// Moving spheres keep the box of their whole path.
+		bool clip_bounds(const AABB& box, AABB& clipped) const override {
+			clipped = aabb_intersection(bbox, box);
+			if(center.direction().len_sqr() > 0) return true;
+			
+			const point3 c = center.origin();
+			interval axes[3] = {clipped.x_i, clipped.y_i, clipped.z_i};
+			
+			for(int a = 0; a < 3; a++) {
+				const interval& slab = box.axis_interval(a);
+				const double d = std::max(0., std::max(slab.min - c[a], c[a] - slab.max));
+				if(d > radius) {
+					clipped = AABB::empty;
+					return true;
+				}
+				
+				const double r = std::sqrt(double(radius) * radius - d * d) * (1 + 1e-9);
+				for(int b = 0; b < 3; b++) {
+					if(b == a) continue;
+					axes[b].min = std::max(axes[b].min, c[b] - r);
+					axes[b].max = std::min(axes[b].max, c[b] + r);
+				}
+			}
+			
+			clipped = AABB(axes[0], axes[1], axes[2]);
+			return true;
+		}
+		
+		void get_surface(const ray& r, hit_record& rec) const override {
+			point3 curr_center = center.at(r.time());
+			
+			// Projected back onto the sphere, so the error of 'p' only depends on the radius
+			vec3 offset = r.at(rec.t) - curr_center;
+			offset *= radius / offset.len();
+			rec.p = curr_center + offset;
+			rec.p_error = gamma_n<double>(5) * abs(offset) + gamma_n<double>(1) * abs(rec.p);
+			
+			vec3 out_normal = offset / radius;
+			rec.set_face_normal(r, out_normal);
+			get_uv(out_normal, rec.u, rec.v);
+			rec.mat = mat.get();
+		}
+		
+		// Center at t=0, center at t=1, radius
+		uint32_t serialize(Scene_Writer& w) const override {
+			primitive_record rec = {};
+			rec.type = PRIM_SPHERE;
+			rec.mat = w.add(mat.get());
+			write_vec3(rec.data,     center.at(0));
+			write_vec3(rec.data + 3, center.at(1));
+			rec.data[6] = radius;
+			return w.push(rec);
+		}
 };
 
 class Constant_Medium : public IHittable {
@@ -153,41 +293,66 @@ class Constant_Medium : public IHittable {
 		: boundary(boundary), neg_inv_density(-1./density),  phase_function(make_shared<Isotropic>(albedo)) {}
 		
 		bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
-			hit_record rec1, rec2;
-			
-			if(!boundary -> hit(r, interval::universe, rec1)) return false;
+			interval span;
+			if(!boundary -> hit_span(r, span)) return false;
 			
-			if(!boundary -> hit(r, interval(rec1.t+0.0001, inf), rec2)) return false;
+			if (span.min < ray_t.min) span.min = ray_t.min;
+			if (span.max > ray_t.max) span.max = ray_t.max;
 			
-			if (rec1.t < ray_t.min) rec1.t = ray_t.min;
-			if (rec2.t > ray_t.max) rec2.t = ray_t.max;
-			
-			if (rec1.t >= rec2.t)
+			if (span.min >= span.max)
 				return false;
 			
-			if(rec1.t < 0) rec1.t = 0;
+			if(span.min < 0) span.min = 0;
 			
 			auto ray_length = r.direction().len();
-			auto distance_inside_boundary = (rec2.t - rec1.t) * ray_length;
-			auto hit_distance = neg_inv_density * std::log(get_rand_double());
+			auto distance_inside_boundary = (span.max - span.min) * ray_length;
+			auto hit_distance = neg_inv_density * fast_log(get_rand_double());
 			
 			if(hit_distance > distance_inside_boundary)
 				return false;
 			
-			rec.t = rec1.t + hit_distance/ray_length;
+			rec.t = span.min + hit_distance/ray_length;
+			rec.prim = this;
+			
+			return true;
+		}
+		
+		// Scattering inside the volume, not on a surface: rays leave from 'p' itself
+		void get_surface(const ray& r, hit_record& rec) const override {
 			rec.p = r.at(rec.t);
+			rec.p_error = vec3(0);
 			
-			rec.normal = vec3(0,1,0);
+			rec.normal = rec.geo_normal = vec3(0,1,0);
 			rec.is_front = true;
-			rec.mat = phase_function;
-			
-			return true;
+			rec.u = rec.v = 0;
+			rec.mat = phase_function.get();
+		}
+		
+		// Density
+		uint32_t serialize(Scene_Writer& w) const override {
+			primitive_record rec = {};
+			rec.type = PRIM_CONSTANT_MEDIUM;
+			rec.boundary = w.add(boundary.get());
+			rec.mat = w.add(phase_function.get());
+			rec.data[0] = -1. / neg_inv_density;
+			return w.push(rec);
 		}
 		
 		AABB bounding_box() const override {
 			return boundary -> bounding_box();
 		}
 		
+		AABB time_bounds(double time) const override {
+			return boundary -> time_bounds(time);
+		}
+		
+		// Each hit samples a new scattering distance,
+		// a second reference would make the medium denser
+		bool clip_bounds(const AABB& box, AABB& clipped) const override {
+			clipped = bounding_box();
+			return false;
+		}
+		
 };
 
 #endif
\ No newline at end of file
@@ -1,14 +1,114 @@
 #ifndef TEXTURE_H
 #define TEXTURE_H
 
+#include <unordered_map>
+
 #include "utils.h"
 #include "utils/img.h"
 
+class ITexture;
+
+enum Texture_Op : uint32_t {
+	TEX_OP_CONST,		// value[0]
+	TEX_OP_CHECKER,		// Branch on the 3D checker cell of p
+	TEX_OP_LOLLIPOP,	// Branch on the stripe of u+v
+	TEX_OP_IMAGE,		// Lookup in 'data', an IMG_Texture
+	TEX_OP_CUSTOM		// Virtual call to 'data', an ITexture
+};
+
+// Node of a compiled texture
+// Selectors pick one of two branches, a branch is a child node
+// or, once folded, a constant color stored in the node itself.
+struct Texture_Node {
+	uint32_t	op;
+	uint32_t	child[2];		// Even, odd; Texture_Program::constant for a folded branch
+	double		scale;
+	color		value[2];
+	const void* data;
+};
+
+// Compiling a texture yields a constant color or a node of the program
+struct Texture_Ref {
+	uint32_t node;
+	color	 value;
+};
+
+// Texture graph flattened into a node array
+// A lookup follows one chain of selectors down to a constant or a leaf,
+// in a single loop without recursion or virtual calls.
+class Texture_Program {
+	private:
+		friend class Texture_Compiler;
+		
+		std::vector<Texture_Node> nodes;
+		uint32_t root = 0;
+	
+	public:
+		static constexpr uint32_t constant = 0xFFFFFFFFu;
+		
+		Texture_Program() : Texture_Program(color(0)) {}
+		
+		Texture_Program(const color& c) {
+			nodes.push_back({TEX_OP_CONST, {constant, constant}, 0, {c, c}, nullptr});
+		}
+		
+		Texture_Program(const ITexture& tex);
+		
+		size_t node_count() const {return nodes.size();}
+		
+		color eval(double u, double v, const point3& p) const;
+};
+
+// Emits a texture graph into a program, only while the program is built
+// Textures met several times are compiled once.
+class Texture_Compiler {
+	private:
+		std::vector<Texture_Node>& nodes;
+		std::unordered_map<const ITexture*, Texture_Ref> compiled;
+	
+	public:
+		static constexpr uint32_t constant = Texture_Program::constant;
+		
+		Texture_Compiler(Texture_Program& prog) : nodes(prog.nodes) {}
+		
+		// Used by ITexture::compile()
+		Texture_Ref add(const ITexture* tex);
+		
+		static Texture_Ref constant_ref(const color& c) {return {constant, c};}
+		
+		Texture_Ref leaf(uint32_t op, const void* data) {
+			nodes.push_back({op, {constant, constant}, 0, {color(0), color(0)}, data});
+			return {uint32_t(nodes.size() - 1), color(0)};
+		}
+		
+		// Two equal constant branches fold to a constant
+		Texture_Ref selector(uint32_t op, double scale, const Texture_Ref& even, const Texture_Ref& odd) {
+			if(even.node == constant && odd.node == constant
+				&& even.value[0] == odd.value[0] && even.value[1] == odd.value[1] && even.value[2] == odd.value[2])
+				return even;
+			
+			nodes.push_back({op, {even.node, odd.node}, scale, {even.value, odd.value}, nullptr});
+			return {uint32_t(nodes.size() - 1), color(0)};
+		}
+};
+
 class ITexture {
 	public:
 		virtual ~ITexture() = default;
 		
 		virtual color value(const double u, const double v, const point3& p) const = 0;
+		
+		// True, with 'c' set, if the texture is the same everywhere
+		virtual bool constant_value(color& c) const {return false;}
+		
+		// Emits this texture through 'comp', a constant or a virtual call node by default
+		virtual Texture_Ref compile(Texture_Compiler& comp) const {
+			color c;
+			if(constant_value(c)) return Texture_Compiler::constant_ref(c);
+			return comp.leaf(TEX_OP_CUSTOM, this);
+		}
+		
+		virtual uint32_t serialize(Scene_Writer& w) const {return Scene_Writer::none;}
 };
 
 class Uniform_Color : public ITexture {
@@ -21,6 +121,18 @@ class Uniform_Color : public ITexture {
 		Uniform_Color(const double r, const double g, const double b) : albedo(color(r, g, b)) {}
 		
 		color value(const double u, const double v, const point3& p) const override {return albedo;}
+		
+		bool constant_value(color& c) const override {
+			c = albedo;
+			return true;
+		}
+		
+		uint32_t serialize(Scene_Writer& w) const override {
+			texture_record rec = {};
+			rec.type = TEX_UNIFORM;
+			write_vec3(rec.albedo, albedo);
+			return w.push(rec);
+		}
 };
 
 class Checker_Texture : public ITexture {
@@ -34,13 +146,31 @@ class Checker_Texture : public ITexture {
 		
 		Checker_Texture(double scale, const color& c0, const color& c1) : inv_scale(1./scale), even(make_shared<Uniform_Color>(c0)), odd(make_shared<Uniform_Color>(c1)) {}
 		
-		// Checker the entire space, for now
-		color value(const double u, const double v, const point3& p) const override {
+		// 1 for odd cells
+		static int parity(double inv_scale, const point3& p) {
 			auto xInt = int(std::floor(inv_scale * p.x()));
 			auto yInt = int(std::floor(inv_scale * p.y()));
 			auto zInt = int(std::floor(inv_scale * p.z()));
 			
-			return ((xInt + yInt + zInt) % 2) ? odd->value(u, v, p) : even->value(u, v, p);
+			return ((xInt + yInt + zInt) % 2) ? 1 : 0;
+		}
+		
+		// Checker the entire space, for now
+		color value(const double u, const double v, const point3& p) const override {
+			return parity(inv_scale, p) ? odd->value(u, v, p) : even->value(u, v, p);
+		}
+		
+		Texture_Ref compile(Texture_Compiler& comp) const override {
+			return comp.selector(TEX_OP_CHECKER, inv_scale, comp.add(even.get()), comp.add(odd.get()));
+		}
+		
+		uint32_t serialize(Scene_Writer& w) const override {
+			texture_record rec = {};
+			rec.type = TEX_CHECKER;
+			rec.scale = 1. / inv_scale;
+			rec.even = w.add(even.get());
+			rec.odd  = w.add(odd.get());
+			return w.push(rec);
 		}
 };
 
@@ -55,20 +185,39 @@ class Lollipop_Texture : public ITexture {
 		
 		Lollipop_Texture(double scale, const color& c0, const color& c1) : scale(scale), even(make_shared<Uniform_Color>(c0)), odd(make_shared<Uniform_Color>(c1)) {}
 		
+		// 1 for odd stripes
+		static int parity(double scale, double u, double v) {
+			return (int(scale*(u+v)) % 2) ? 1 : 0;
+		}
+		
 		// Checker the entire space, for now
 		color value(const double u, const double v, const point3& p) const override {
-			return (int(scale*(u+v)) % 2) ? odd->value(u, v, p) : even->value(u, v, p);
+			return parity(scale, u, v) ? odd->value(u, v, p) : even->value(u, v, p);
+		}
+		
+		Texture_Ref compile(Texture_Compiler& comp) const override {
+			return comp.selector(TEX_OP_LOLLIPOP, scale, comp.add(even.get()), comp.add(odd.get()));
+		}
+		
+		uint32_t serialize(Scene_Writer& w) const override {
+			texture_record rec = {};
+			rec.type = TEX_LOLLIPOP;
+			rec.scale = scale;
+			rec.even = w.add(even.get());
+			rec.odd  = w.add(odd.get());
+			return w.push(rec);
 		}
 };
 
 class IMG_Texture : public ITexture {
 	private:
 		IMG image;
+		std::string filename;
 	
 	public:
-		IMG_Texture(const char* filename) : image(filename) {}
+		IMG_Texture(const char* filename) : image(filename), filename(filename) {}
 		
-		color value(double u, double v, const point3& p) const override {
+		color sample(double u, double v) const {
 			if(image.height() <= 0) return color(1, 0, 1);
 			
 			u = interval::unit.clamp(u);
@@ -83,6 +232,59 @@ class IMG_Texture : public ITexture {
 			return color_scale * color(pixel[0], pixel[1], pixel[2]);
 			
 		}
+		
+		color value(double u, double v, const point3& p) const override {
+			return sample(u, v);
+		}
+		
+		Texture_Ref compile(Texture_Compiler& comp) const override {
+			return comp.leaf(TEX_OP_IMAGE, this);
+		}
+		
+		uint32_t serialize(Scene_Writer& w) const override {
+			texture_record rec = {};
+			rec.type = TEX_IMAGE;
+			rec.name = w.push_name(filename);
+			return w.push(rec);
+		}
 };
 
+inline Texture_Program::Texture_Program(const ITexture& tex) {
+	Texture_Ref ref = Texture_Compiler(*this).add(&tex);
+	if(ref.node == constant)
+		nodes.push_back({TEX_OP_CONST, {constant, constant}, 0, {ref.value, ref.value}, nullptr});
+	root = (ref.node == constant) ? nodes.size() - 1 : ref.node;
+}
+
+inline Texture_Ref Texture_Compiler::add(const ITexture* tex) {
+	auto it = compiled.find(tex);
+	if(it != compiled.end()) return it->second;
+	return compiled[tex] = tex -> compile(*this);
+}
+
+inline color Texture_Program::eval(double u, double v, const point3& p) const {
+	uint32_t idx = root;
+	for(;;) {
+		const Texture_Node& node = nodes[idx];
+		int branch;
+		switch(node.op) {
+			case TEX_OP_CONST:
+				return node.value[0];
+			case TEX_OP_CHECKER:
+				branch = Checker_Texture::parity(node.scale, p);
+				break;
+			case TEX_OP_LOLLIPOP:
+				branch = Lollipop_Texture::parity(node.scale, u, v);
+				break;
+			case TEX_OP_IMAGE:
+				return static_cast<const IMG_Texture*>(node.data) -> sample(u, v);
+			default:
+				return static_cast<const ITexture*>(node.data) -> value(u, v, p);
+		}
+		
+		if(node.child[branch] == constant) return node.value[branch];
+		idx = node.child[branch];
+	}
+}
+
 #endif
\ No newline at end of file
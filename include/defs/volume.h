@@ -0,0 +1,287 @@
+#ifndef VOLUME_H
+#define VOLUME_H
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <omp.h>
+
+#include "utils.h"
+#include "defs/hittable.h"
+#include "defs/material.h"
+
+// Heterogeneous medium sampled on a voxel grid over a box
+// Voxels are stored by 8^3 bricks, and only for bricks that are not uniform:
+// empty space and constant cores cost a single float.
+// Each brick keeps its largest density, the majorant that free paths (delta tracking)
+// and transmittance estimates (ratio tracking) step through, brick by brick.
+class Grid_Medium : public IHittable {
+	private:
+		static constexpr int brick_size = 8;
+		static constexpr int brick_voxels = brick_size * brick_size * brick_size;
+		static constexpr uint32_t uniform_brick = ~uint32_t(0);
+		
+		AABB bbox;
+		point3 grid_min;
+		vec3 voxel_size;
+		int res[3];
+		int bricks[3];
+		
+		std::vector<float> majorant;			// Per brick, also the density of uniform bricks
+		std::vector<uint32_t> brick_offset;		// Into 'voxels', uniform_brick for uniform bricks
+		std::vector<float> voxels;
+		
+		shared_ptr<IMaterial> phase_function;
+		
+		void init(const AABB& box, int nx, int ny, int nz) {
+			bbox = box;
+			res[0] = std::max(nx, 1);
+			res[1] = std::max(ny, 1);
+			res[2] = std::max(nz, 1);
+			for(int a = 0; a < 3; a++) {
+				grid_min[a] = box.axis_interval(a).min;
+				voxel_size[a] = box.axis_interval(a).size() / res[a];
+				bricks[a] = (res[a] + brick_size - 1) / brick_size;
+			}
+		}
+		
+		// Samples 'density' at voxel centers, brick by brick
+		void build(const std::function<float(const point3&)>& density) {
+			const size_t brick_count = size_t(bricks[0]) * bricks[1] * bricks[2];
+			majorant.assign(brick_count, 0);
+			brick_offset.assign(brick_count, uint32_t(uniform_brick));
+			std::vector<std::vector<float>> brick_data(brick_count);
+			
+			#pragma omp parallel for schedule(dynamic)
+			for(size_t b = 0; b < brick_count; b++) {
+				const int base[3] = {
+					int(b % bricks[0]) * brick_size,
+					int(b / bricks[0] % bricks[1]) * brick_size,
+					int(b / (size_t(bricks[0]) * bricks[1])) * brick_size
+				};
+				
+				std::vector<float> data(brick_voxels);
+				for(int i = 0; i < brick_voxels; i++) {
+					// Voxels past the grid edge repeat the last one
+					int v[3] = {i % brick_size, i / brick_size % brick_size, i / (brick_size * brick_size)};
+					point3 p;
+					for(int a = 0; a < 3; a++)
+						p[a] = grid_min[a] + (std::min(base[a] + v[a], res[a] - 1) + .5) * voxel_size[a];
+					data[i] = std::max(0.f, density(p));
+				}
+				
+				majorant[b] = *std::max_element(data.begin(), data.end());
+				if(*std::min_element(data.begin(), data.end()) != majorant[b])
+					brick_data[b].swap(data);
+			}
+			
+			size_t dense_count = 0;
+			for(const auto& data : brick_data)
+				dense_count += !data.empty();
+			voxels.reserve(dense_count * brick_voxels);
+			
+			for(size_t b = 0; b < brick_count; b++) {
+				if(brick_data[b].empty()) continue;
+				brick_offset[b] = voxels.size();
+				voxels.insert(voxels.end(), brick_data[b].begin(), brick_data[b].end());
+			}
+		}
+		
+		size_t brick_index(const int* cell) const {
+			return cell[0] + size_t(bricks[0]) * (cell[1] + size_t(bricks[1]) * cell[2]);
+		}
+		
+		// Nearest voxel, so the brick majorant bounds it exactly
+		float density_at(const point3& p) const {
+			int v[3];
+			for(int a = 0; a < 3; a++)
+				v[a] = std::min(res[a] - 1, std::max(0, int((p[a] - grid_min[a]) / voxel_size[a])));
+			
+			const int cell[3] = {v[0] / brick_size, v[1] / brick_size, v[2] / brick_size};
+			const size_t b = brick_index(cell);
+			if(brick_offset[b] == uniform_brick) return majorant[b];
+			
+			const int local = v[0] % brick_size + brick_size * (v[1] % brick_size + brick_size * (v[2] % brick_size));
+			return voxels[brick_offset[b] + local];
+		}
+		
+		// Walks the bricks crossed by 'r' over 'span' (3D DDA),
+		// calling f(brick, t_enter, t_exit) until it returns true
+		template<typename F>
+		bool march(const ray& r, const interval& span, F f) const {
+			const vec3& dir = r.direction();
+			const point3 start = r.at(span.min);
+			
+			int cell[3], step[3];
+			double t_next[3], t_delta[3];
+			for(int a = 0; a < 3; a++) {
+				const double brick_width = voxel_size[a] * brick_size;
+				cell[a] = std::min(bricks[a] - 1, std::max(0, int(std::floor((start[a] - grid_min[a]) / brick_width))));
+				
+				if(dir[a] > 0) {
+					step[a] = 1;
+					t_next[a] = span.min + (grid_min[a] + (cell[a] + 1) * brick_width - start[a]) / dir[a];
+					t_delta[a] = brick_width / dir[a];
+				} else if(dir[a] < 0) {
+					step[a] = -1;
+					t_next[a] = span.min + (grid_min[a] + cell[a] * brick_width - start[a]) / dir[a];
+					t_delta[a] = -brick_width / dir[a];
+				} else {
+					step[a] = 0;
+					t_next[a] = t_delta[a] = inf;
+				}
+			}
+			
+			double t = span.min;
+			while(t < span.max) {
+				int a = (t_next[0] < t_next[1]) ? 0 : 1;
+				if(t_next[2] < t_next[a]) a = 2;
+				
+				const double t_exit = std::min(t_next[a], span.max);
+				if(t_exit > t && f(brick_index(cell), t, t_exit)) return true;
+				
+				t = t_exit;
+				cell[a] += step[a];
+				if(cell[a] < 0 || cell[a] >= bricks[a]) break;
+				t_next[a] += t_delta[a];
+			}
+			return false;
+		}
+		
+		// Part of ray_t inside the grid box
+		bool clip_span(const ray& r, interval ray_t, interval& span) const {
+			if(!hit_span(r, span)) return false;
+			span.min = std::max(span.min, ray_t.min);
+			span.max = std::min(span.max, ray_t.max);
+			return span.min < span.max;
+		}
+	
+	public:
+		// 'density' is sampled at the voxel centers of an nx * ny * nz grid over 'box'
+		Grid_Medium(const AABB& box, int nx, int ny, int nz, const std::function<float(const point3&)>& density, shared_ptr<ITexture> tex)
+		: phase_function(make_shared<Isotropic>(tex)) {
+			init(box, nx, ny, nz);
+			build(density);
+		}
+		
+		Grid_Medium(const AABB& box, int nx, int ny, int nz, const std::function<float(const point3&)>& density, const color& albedo)
+		: phase_function(make_shared<Isotropic>(albedo)) {
+			init(box, nx, ny, nz);
+			build(density);
+		}
+		
+		// Dense densities, x fastest
+		Grid_Medium(const AABB& box, int nx, int ny, int nz, const std::vector<float>& density, const color& albedo)
+		: phase_function(make_shared<Isotropic>(albedo)) {
+			init(box, nx, ny, nz);
+			const bool complete = density.size() >= size_t(res[0]) * res[1] * res[2];
+			build([this, &density, complete](const point3& p) {
+				if(!complete) return 0.f;
+				int v[3];
+				for(int a = 0; a < 3; a++)
+					v[a] = std::min(res[a] - 1, int((p[a] - grid_min[a]) / voxel_size[a]));
+				return density[v[0] + size_t(res[0]) * (v[1] + size_t(res[1]) * v[2])];
+			});
+		}
+		
+		size_t memory_bytes() const {
+			return majorant.capacity() * sizeof(float)
+				 + brick_offset.capacity() * sizeof(uint32_t)
+				 + voxels.capacity() * sizeof(float);
+		}
+		
+		size_t dense_brick_count() const {return voxels.size() / brick_voxels;}
+		
+		AABB bounding_box() const override {return bbox;}
+		
+		// Span of the grid box
+		bool hit_span(const ray& r, interval& span) const override {
+			span = interval::universe;
+			for(int a = 0; a < 3; a++) {
+				const interval& ax = bbox.axis_interval(a);
+				const double inv_dir = 1. / r.direction()[a];
+				double t0 = (ax.min - r.origin()[a]) * inv_dir;
+				double t1 = (ax.max - r.origin()[a]) * inv_dir;
+				if(inv_dir < 0) std::swap(t0, t1);
+				span.min = std::max(span.min, t0);
+				span.max = std::min(span.max, t1);
+			}
+			return span.min < span.max;
+		}
+		
+		// Delta tracking: tentative collisions at the brick majorant,
+		// kept with probability density / majorant
+		bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+			interval span;
+			if(!clip_span(r, ray_t, span)) return false;
+			
+			const double inv_len = 1. / r.direction().len();
+			double t_hit = 0;
+			
+			bool scattered = march(r, span, [&](size_t b, double t, double t_exit) {
+				const float m = majorant[b];
+				if(m <= 0) return false;
+				
+				for(;;) {
+					t -= fast_log(1 - get_rand_double()) * inv_len / m;
+					if(t >= t_exit) return false;
+					if(brick_offset[b] == uniform_brick || get_rand_double() * m < density_at(r.at(t))) {
+						t_hit = t;
+						return true;
+					}
+				}
+			});
+			if(!scattered) return false;
+			
+			rec.t = t_hit;
+			rec.prim = this;
+			return true;
+		}
+		
+		// Scattering inside the volume, not on a surface: rays leave from 'p' itself
+		void get_surface(const ray& r, hit_record& rec) const override {
+			rec.p = r.at(rec.t);
+			rec.p_error = vec3(0);
+			
+			rec.normal = rec.geo_normal = vec3(0,1,0);
+			rec.is_front = true;
+			rec.u = rec.v = 0;
+			rec.mat = phase_function.get();
+		}
+		
+		// Unbiased estimate of the fraction of light crossing ray_t
+		// Ratio tracking through varying bricks, closed form through uniform ones
+		double transmittance(const ray& r, interval ray_t) const {
+			interval span;
+			if(!clip_span(r, ray_t, span)) return 1;
+			
+			const double len = r.direction().len();
+			double T = 1;
+			
+			march(r, span, [&](size_t b, double t, double t_exit) {
+				const float m = majorant[b];
+				if(m <= 0) return false;
+				
+				if(brick_offset[b] == uniform_brick) {
+					T *= std::exp(-m * (t_exit - t) * len);
+					return false;
+				}
+				
+				for(;;) {
+					t -= fast_log(1 - get_rand_double()) / (m * len);
+					if(t >= t_exit) return false;
+					T *= 1 - density_at(r.at(t)) / m;
+					if(T <= 0) return true;
+				}
+			});
+			return T;
+		}
+		
+		// Each hit samples a new free path, like Constant_Medium
+		bool clip_bounds(const AABB& box, AABB& clipped) const override {
+			clipped = bbox;
+			return false;
+		}
+};
+
+#endif
\ No newline at end of file
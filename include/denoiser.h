@@ -0,0 +1,202 @@
+#ifndef DENOISER_H
+#define DENOISER_H
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <omp.h>
+
+#include "utils/float_image.h"
+
+// AOV planes written by the camera for the first hit of each pixel
+enum AOV_Channel {
+	AOV_ALBEDO_R, AOV_ALBEDO_G, AOV_ALBEDO_B,
+	AOV_NORMAL_X, AOV_NORMAL_Y, AOV_NORMAL_Z,
+	AOV_DEPTH,
+	AOV_COUNT
+};
+
+// Edge-avoiding A-Trous wavelet filter (Dammertz et al. 2010)
+// Illumination is demodulated by the albedo AOV, filtered with
+// a 5x5 B3-spline kernel of growing step, and remodulated,
+// so texture detail survives while the noise is smoothed.
+// Colour, normal and depth differences stop the kernel at edges.
+class Denoiser {
+	private:
+		Float_Image illum, scratch, tonemapped;
+		
+		// Planes a filter pass reads
+		// Colour distances use the tonemapped 'tr/tg/tb' copy,
+		// so fireflies do not stop the kernel on their own
+		struct Guide {
+			const float *r, *g, *b;
+			const float *tr, *tg, *tb;
+			const float *nx, *ny, *nz, *z;
+		};
+		
+		static constexpr float albedo_eps = 1e-3f;
+		
+		// Adds neighbour 'q' to the weighted sum of pixel 'p'
+		// Kept branch-free so the interior loop vectorizes
+		static inline void tap(const Guide& G, size_t p, size_t q, float h,
+			float inv_sc, float inv_sn, float tol_z,
+			float& sr, float& sg, float& sb, float& sw) {
+			
+			float dr = G.tr[p] - G.tr[q];
+			float dg = G.tg[p] - G.tg[q];
+			float db = G.tb[p] - G.tb[q];
+			float dc = dr*dr + dg*dg + db*db;
+			
+			float ex = G.nx[p] - G.nx[q];
+			float ey = G.ny[p] - G.ny[q];
+			float ez = G.nz[p] - G.nz[q];
+			float dn = ex*ex + ey*ey + ez*ez;
+			
+			float dz = std::fabs(G.z[p] - G.z[q]) / (G.z[p] * tol_z + 1e-4f);
+			
+			float w = h * std::exp(-(dc*inv_sc + dn*inv_sn + dz));
+			
+			sr += w * G.r[q];
+			sg += w * G.g[q];
+			sb += w * G.b[q];
+			sw += w;
+		}
+		
+		void pass(const Float_Image& src, Float_Image& dst, const Float_Image& aov, int step, float sigma_c) {
+			static const float kernel[5] = {1.f/16, 1.f/4, 3.f/8, 1.f/4, 1.f/16};
+			
+			const int W = src.width;
+			const int H = src.height;
+			const size_t N = src.size();
+			
+			// Reinhard-compressed guide
+			tonemapped.resize(W, H, 3);
+			for(int c = 0; c < 3; c++) {
+				const float* in = src.plane(c);
+				float* out = tonemapped.plane(c);
+				
+				#pragma omp parallel for simd
+				for(size_t i = 0; i < N; i++)
+					out[i] = in[i] / (1.f + in[i]);
+			}
+			
+			const Guide G = {
+				src.plane(0), src.plane(1), src.plane(2),
+				tonemapped.plane(0), tonemapped.plane(1), tonemapped.plane(2),
+				aov.plane(AOV_NORMAL_X), aov.plane(AOV_NORMAL_Y), aov.plane(AOV_NORMAL_Z),
+				aov.plane(AOV_DEPTH)
+			};
+			
+			const float inv_sc = 1.f / (sigma_c * sigma_c);
+			const float inv_sn = 1.f / sigma_normal;
+			// Depth tolerance grows with the footprint of the tap
+			const float tol_z = sigma_depth * step;
+			
+			float* out_r = dst.plane(0);
+			float* out_g = dst.plane(1);
+			float* out_b = dst.plane(2);
+			
+			#pragma omp parallel
+			{
+				// Per-row accumulators, one plane each
+				std::vector<float> acc(4 * size_t(W));
+				float* sr = acc.data();
+				float* sg = sr + W;
+				float* sb = sg + W;
+				float* sw = sb + W;
+				
+				#pragma omp for schedule(dynamic, 4)
+				for(int y = 0; y < H; y++) {
+					std::fill(acc.begin(), acc.end(), 0.f);
+					const size_t row = size_t(y) * W;
+					
+					for(int ky = -2; ky <= 2; ky++) {
+						const int yy = std::min(std::max(y + ky*step, 0), H-1);
+						const size_t nrow = size_t(yy) * W;
+						
+						for(int kx = -2; kx <= 2; kx++) {
+							const int off = kx * step;
+							const float h = kernel[ky+2] * kernel[kx+2];
+							
+							// Columns whose neighbour lies inside the image
+							int x0 = std::min(W, std::max(0, -off));
+							int x1 = std::max(0, std::min(W, W - off));
+							if(x1 < x0) x0 = x1 = W;
+							
+							#pragma omp simd
+							for(int x = x0; x < x1; x++)
+								tap(G, row + x, nrow + x + off, h, inv_sc, inv_sn, tol_z,
+									sr[x], sg[x], sb[x], sw[x]);
+							
+							// Borders clamp to the edge
+							for(int x = 0; x < x0; x++)
+								tap(G, row + x, nrow + std::min(std::max(x + off, 0), W-1), h,
+									inv_sc, inv_sn, tol_z, sr[x], sg[x], sb[x], sw[x]);
+							for(int x = x1; x < W; x++)
+								tap(G, row + x, nrow + std::min(std::max(x + off, 0), W-1), h,
+									inv_sc, inv_sn, tol_z, sr[x], sg[x], sb[x], sw[x]);
+						}
+					}
+					
+					// Center tap always weighs in, so sw > 0
+					#pragma omp simd
+					for(int x = 0; x < W; x++) {
+						const float inv_w = 1.f / sw[x];
+						out_r[row + x] = sr[x] * inv_w;
+						out_g[row + x] = sg[x] * inv_w;
+						out_b[row + x] = sb[x] * inv_w;
+					}
+				}
+			}
+		}
+	
+	public:
+		int   iterations   = 5;
+		float sigma_color  = 2.f;	// Tonemapped, halved every iteration
+		float sigma_normal = .1f;
+		float sigma_depth  = .1f;	// Relative to the center depth
+		
+		// Duration of the last run, in milliseconds
+		double last_ms = 0;
+		
+		// 'frame' holds 3 HDR planes, 'aov' the AOV_COUNT planes above
+		void run(Float_Image& frame, const Float_Image& aov) {
+			auto start_time = std::chrono::steady_clock::now();
+			
+			const size_t N = frame.size();
+			illum.resize(frame.width, frame.height, 3);
+			scratch.resize(frame.width, frame.height, 3);
+			
+			for(int c = 0; c < 3; c++) {
+				const float* in  = frame.plane(c);
+				const float* alb = aov.plane(AOV_ALBEDO_R + c);
+				float* out = illum.plane(c);
+				
+				#pragma omp parallel for simd
+				for(size_t i = 0; i < N; i++)
+					out[i] = in[i] / std::max(alb[i], albedo_eps);
+			}
+			
+			float sigma_c = sigma_color;
+			for(int i = 0; i < iterations; i++) {
+				pass(illum, scratch, aov, 1 << i, sigma_c);
+				std::swap(illum, scratch);
+				sigma_c *= .5f;
+			}
+			
+			for(int c = 0; c < 3; c++) {
+				const float* in  = illum.plane(c);
+				const float* alb = aov.plane(AOV_ALBEDO_R + c);
+				float* out = frame.plane(c);
+				
+				#pragma omp parallel for simd
+				for(size_t i = 0; i < N; i++)
+					out[i] = in[i] * std::max(alb[i], albedo_eps);
+			}
+			
+			auto end_time = std::chrono::steady_clock::now();
+			last_ms = std::chrono::duration<double, std::milli>(end_time - start_time).count();
+		}
+};
+
+#endif
\ No newline at end of file
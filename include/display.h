@@ -3,6 +3,7 @@
 
 #include <SDL2/SDL.h>
 
+#include <atomic>
 #include <vector>
 #include <cstdint>
 
@@ -10,6 +11,8 @@
 
 using namespace std;
 
+class Camera;
+
 // Window dimensions
 const int WIDTH  		= 640;
 const int HEIGHT 		= 480;
@@ -21,12 +24,35 @@ extern SDL_Renderer* 	g_renderer;
 extern SDL_Texture*		g_texture; // Frame buffer
 extern SDL_Event 		g_event;
 
+// Cleared by the window or Escape, stops both threads
+extern std::atomic<bool> is_running;
+
 
 void init_SDL(void);
 void close_SDL(void);
 void handle_INPUT(void);
-void update_RENDER(void);
+
+// Frames are rendered on their own thread, the main thread
+// keeps handling input and presents the latest finished frame
+void start_RENDER(void);
+void stop_RENDER(void);
+void present_FRAME(void);
+
+// Set by --cache: setup_SCENE() then reuses the scene and its BVH saved there
+// by an earlier run, instead of building them; nullptr writes nothing
+extern const char* scene_cache_path;
 
 void setup_SCENE(void);
 
+// View and quality defaults shared by every render path, builds no scene
+// Called before Camera::init_CAMERA()
+void setup_CAMERA(Camera& c);
+
+// Renders the scene through 'workers' processes to a PPM file
+bool farm_RENDER(int workers, const char* path);
+
+// Renders frames [first, last] of the animated scene with the quality of
+// setup_CAMERA(), streamed out as they finish (see Frame_Writer for 'output')
+bool sequence_RENDER(int first, int last, const char* output);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,113 @@
+#ifndef FRAME_BUDGET_H
+#define FRAME_BUDGET_H
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+// What the next frame is rendered with
+struct Frame_Settings {
+	float scale   = 1;		// Of the window resolution, per axis
+	int   samples = 1;		// Per pixel, SAMPLING_MODE only
+	int   bounces = 10;
+	bool  refine  = false;	// Still camera: full quality, frames accumulate
+};
+
+// Keeps frames within a time budget while the camera moves
+// The cost of a frame is taken as proportional to bounces * samples * scale^2.
+// Over budget, bounces go first, then samples, then resolution;
+// under budget they come back in the reverse order.
+// Once the camera has been still for a moment, frames switch to full quality
+// and accumulate, so the image refines progressively.
+class Frame_Budget {
+	private:
+		typedef std::chrono::steady_clock clock;
+		
+		Frame_Settings current;
+		double last_ms = 0;
+		bool refining = false;
+		clock::time_point last_move = clock::now();
+		
+		// Resolution steps, so small changes do not reallocate every frame
+		static constexpr float scale_step = 1.f / 32;
+		
+		// Scales one quality setting by up to 'factor', returns the factor left
+		static double spend(int& value, int lo, int hi, double factor) {
+			const int old = value;
+			value = std::max(lo, std::min(hi, int(std::floor(value * factor + 1e-9))));
+			if(factor > 1) value = std::max(value, std::min(hi, old + 1));
+			return factor * old / value;
+		}
+		
+		double spend_scale(double factor) {
+			const float old = current.scale;
+			float s = float(old * std::sqrt(factor));
+			s = (factor > 1 ? std::ceil(s / scale_step) : std::floor(s / scale_step)) * scale_step;
+			current.scale = std::max(min_scale, std::min(1.f, s));
+			return factor * (old * old) / (current.scale * current.scale);
+		}
+	
+	public:
+		double target_ms	= 33;
+		double still_ms		= 250;		// Before refining
+		float  min_scale	= .25f;
+		int    min_bounces	= 4;
+		int    max_bounces	= 10;
+		int    max_samples	= 1;
+		int    max_refine	= 1024;		// Frames accumulated before the renderer idles
+		
+		// Frames within this ratio of the target are left alone
+		double tolerance	= .2;
+		
+		Frame_Budget() {}
+		
+		Frame_Budget(double target_ms, int max_bounces, int max_samples)
+		: target_ms(target_ms), max_bounces(max_bounces), max_samples(max_samples) {
+			current.bounces = max_bounces;
+			current.samples = max_samples;
+		}
+		
+		// Time taken by the frame rendered with the last settings
+		// Full quality frames are not measured, moving again
+		// starts from the last moving settings
+		void record(double ms) {
+			if(!refining) last_ms = ms;
+		}
+		
+		Frame_Settings next(bool moved) {
+			const clock::time_point now = clock::now();
+			if(moved) last_move = now;
+			
+			refining = std::chrono::duration<double, std::milli>(now - last_move).count() >= still_ms;
+			if(refining) {
+				Frame_Settings full;
+				full.bounces = max_bounces;
+				full.samples = max_samples;
+				full.refine  = true;
+				return full;
+			}
+			
+			if(last_ms <= 0) return current;
+			double factor = target_ms / last_ms;
+			
+			if(factor < 1 - tolerance) {
+				factor = spend(current.bounces, min_bounces, max_bounces, factor);
+				factor = spend(current.samples, 1, max_samples, factor);
+				spend_scale(factor);
+			} else if(factor > 1 + tolerance) {
+				// Recovered gently, the cost model flatters bounces
+				factor = std::sqrt(factor);
+				factor = spend_scale(factor);
+				if(current.scale >= 1) {
+					factor = spend(current.samples, 1, max_samples, factor);
+					if(current.samples >= max_samples)
+						spend(current.bounces, min_bounces, max_bounces, factor);
+				}
+			}
+			last_ms = 0;
+			
+			return current;
+		}
+};
+
+#endif
\ No newline at end of file
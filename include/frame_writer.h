@@ -0,0 +1,63 @@
+#ifndef FRAME_WRITER_H
+#define FRAME_WRITER_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Writes the frames of a sequence on a thread of its own,
+// so encoding and disk or pipe writes overlap rendering the next frame
+// 'output' is either a printf pattern of numbered PPM files ("frames/%04d.ppm"),
+// with a single integer conversion, or a YUV4MPEG2 stream: a path ending in ".y4m",
+// or "-" for stdout
+// (e.g. piped into ffmpeg -i - out.mp4)
+class Frame_Writer {
+	private:
+		struct Pending {
+			int index;
+			std::vector<uint32_t> pixels;		// ARGB8888
+		};
+		
+		std::string output;
+		int width, height;
+		double fps;
+		size_t queue_depth;
+		
+		FILE* stream = nullptr;				// Y4M only
+		std::vector<uint8_t> planes;		// Y, Cb and Cr of a frame
+		
+		std::deque<Pending> queue;
+		std::mutex lock;
+		std::condition_variable changed;
+		bool closing = false;
+		bool failed = false;
+		
+		std::thread worker;
+		
+		void run();
+		bool write(const Pending& frame);
+		bool write_y4m(const std::vector<uint32_t>& pixels);
+	
+	public:
+		// Up to 'queue_depth' frames wait to be written before push() blocks
+		Frame_Writer(const std::string& output, int width, int height, double fps, size_t queue_depth = 2);
+		
+		// Writes whatever is still queued
+		~Frame_Writer();
+		
+		Frame_Writer(const Frame_Writer&) = delete;
+		Frame_Writer& operator=(const Frame_Writer&) = delete;
+		
+		// Takes the pixels of frame 'index', false once a write has failed
+		bool push(int index, std::vector<uint32_t>&& pixels);
+		
+		// Waits for the queue to drain, false if any write failed
+		bool finish();
+};
+
+#endif
\ No newline at end of file
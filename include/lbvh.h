@@ -4,7 +4,10 @@
 #include "defs.h"
 
 #include <algorithm>
+#include <chrono>
+#include <iostream>
 #include <omp.h>
+#include <unordered_set>
 
 struct BVH_node {
 	AABB 	 bbox;
@@ -13,24 +16,99 @@ struct BVH_node {
 	bool 	 leaf;
 };
 
+// Memory order of the nodes, see LBVH::reorder()
+enum BVH_Order {
+	ORDER_DEPTH_FIRST,		// Parent, left subtree, right subtree (construction order)
+	ORDER_VAN_EMDE_BOAS		// Recursive split into top and bottom trees of half the height
+};
+
+// Build phase durations, in ms
+// Left at zero for adopted trees
+struct BVH_build_times {
+	double bounds_ms	= 0;	// Primitive boxes and centroids
+	double construct_ms = 0;	// Recursive split
+	double total_ms		= 0;
+};
+
+// Quality figures of a tree, see LBVH::report()
+struct BVH_report {
+	size_t node_count		= 0;
+	size_t leaf_count		= 0;
+	size_t primitive_count	= 0;
+	size_t max_depth		= 0;
+	
+	// Expected cost of a ray hitting the root,
+	// with one unit per node visit and per primitive test
+	double sah_cost 		= 0;
+	
+	// Mean over inner nodes of the area shared by both children,
+	// relative to the node area
+	double overlap_ratio	= 0;
+	
+	std::vector<size_t> depth_histogram;	// Nodes per depth
+	std::vector<size_t> leaf_histogram;		// Leaves per primitive count
+	
+	size_t node_bytes		= 0;
+	size_t register_bytes	= 0;
+	
+	BVH_build_times times;
+	
+	void print(std::ostream& out) const {
+		out << "BVH: " << node_count << " nodes, " << leaf_count << " leaves, "
+			<< primitive_count << " primitives" << std::endl;
+		out << "  SAH cost: " << sah_cost << " | sibling overlap: " << 100 * overlap_ratio << "%"
+			<< " | max depth: " << max_depth << std::endl;
+		out << "  Memory: " << node_bytes / 1024. << " KiB nodes + "
+			<< register_bytes / 1024. << " KiB register" << std::endl;
+		out << "  Build: " << times.bounds_ms << " ms bounds + "
+			<< times.construct_ms << " ms construct (" << times.total_ms << " ms total)" << std::endl;
+		
+		out << "  Depth:";
+		for(size_t d = 0; d < depth_histogram.size(); d++)
+			if(depth_histogram[d]) out << " " << d << ":" << depth_histogram[d];
+		out << std::endl;
+		
+		out << "  Leaf size:";
+		for(size_t n = 0; n < leaf_histogram.size(); n++)
+			if(leaf_histogram[n]) out << " " << n << ":" << leaf_histogram[n];
+		out << std::endl;
+	}
+};
+
 class LBVH : public IHittable {
 	private:
 		static constexpr int leafThreshold = 4;
 		std::vector<BVH_node> nodes;
 		std::vector<std::shared_ptr<IHittable>> primitives_register;
 		
+		// Traversal reads 'tree', which points into 'nodes'
+		// or into memory kept alive by 'tree_storage' (e.g. a mapped scene cache)
+		const BVH_node* tree = nullptr;
+		size_t tree_size = 0;
+		std::shared_ptr<const void> tree_storage;
+		
+		// Some primitives are in several leaves, with clipped bounds (an adopted SBVH)
+		bool split_references = false;
+		
+		// Part of the shutter the tree is built for, see IHittable::time_bounds()
+		interval shutter = interval(0, 1);
+		
+		// Moving linearly, an object stays within the union of its bounds at both ends
+		AABB shutter_bounds(const IHittable& obj) const {
+			if(shutter.min <= 0 && shutter.max >= 1) return obj.bounding_box();
+			return AABB(obj.time_bounds(shutter.min), obj.time_bounds(shutter.max));
+		}
+		
 		struct ObjectDef {
 			std::shared_ptr<IHittable> obj;
 			AABB bbox;
 			point3 centroid;
 		};
-
-	public:
-		LBVH(const hittable_list& list) : LBVH(list.objects) {}
 		
-		LBVH(const std::vector<std::shared_ptr<IHittable>>& objects) {
+		void build(const std::vector<std::shared_ptr<IHittable>>& objects) {
 			if(objects.empty()) return;
 			
+			auto build_start = std::chrono::steady_clock::now();
 			const size_t object_count = objects.size();
 			
 			std::vector<ObjectDef> entries(object_count);
@@ -43,10 +121,12 @@ class LBVH : public IHittable {
 			// }
 			
 			for(size_t i = 0; i < object_count; i++){
-				AABB box = objects[i] -> bounding_box();
+				AABB box = shutter_bounds(*objects[i]);
 				entries[i] = {objects[i], box, aabb_centroid(box)};
 			}
 			
+			auto construct_start = std::chrono::steady_clock::now();
+			
 			nodes.reserve(object_count * 2);
 			primitives_register.reserve(object_count);
 			
@@ -59,13 +139,242 @@ class LBVH : public IHittable {
 					construct(entries, 0, entries.size());
 				}
 			}
+			
+			tree = nodes.data();
+			tree_size = nodes.size();
+			
+			auto build_end = std::chrono::steady_clock::now();
+			typedef std::chrono::duration<double, std::milli> ms;
+			build_times.bounds_ms	 = ms(construct_start - build_start).count();
+			build_times.construct_ms = ms(build_end - construct_start).count();
+			build_times.total_ms	 = ms(build_end - build_start).count();
+		}
+	
+	public:
+		LBVH(const hittable_list& list) : LBVH(list.objects) {}
+		
+		LBVH(const std::vector<std::shared_ptr<IHittable>>& objects) {
+			build(objects);
+		}
+		
+		// Bounds only cover the objects over 'shutter', within [0, 1],
+		// so rays at other times may miss them
+		LBVH(const std::vector<std::shared_ptr<IHittable>>& objects, interval shutter) : shutter(shutter) {
+			build(objects);
+		}
+		
+		// Adopts an already built tree, 'storage' owns 'node_data'
+		LBVH(const BVH_node* node_data, size_t node_count,
+			std::vector<std::shared_ptr<IHittable>>&& primitives,
+			std::shared_ptr<const void> storage)
+		: primitives_register(std::move(primitives)), tree(node_data), tree_size(node_count), tree_storage(storage) {
+			split_references = unique_primitives().size() != primitives_register.size();
+		}
+		
+		// 'tree' may point into 'nodes'
+		LBVH(const LBVH&) = delete;
+		LBVH& operator=(const LBVH&) = delete;
+		
+		const BVH_node* tree_nodes() const {return tree;}
+		size_t tree_node_count() const {return tree_size;}
+		const std::vector<std::shared_ptr<IHittable>>& primitives() const {return primitives_register;}
+		
+		BVH_build_times build_times;
+		
+		BVH_report report() const {
+			BVH_report rep;
+			rep.node_count = tree_size;
+			rep.primitive_count = primitives_register.size();
+			rep.node_bytes = tree_size * sizeof(BVH_node);
+			rep.register_bytes = primitives_register.capacity() * sizeof(std::shared_ptr<IHittable>);
+			rep.times = build_times;
+			if(tree_size == 0) return rep;
+			
+			const double root_area = std::max(tree[0].bbox.surface_area(), 1e-12);
+			double overlap_sum = 0;
+			
+			struct Entry {uint32_t idx; size_t depth;};
+			std::vector<Entry> stack = {{0, 0}};
+			
+			while(!stack.empty()) {
+				const Entry entry = stack.back();
+				stack.pop_back();
+				const BVH_node& node = tree[entry.idx];
+				
+				if(rep.depth_histogram.size() <= entry.depth) rep.depth_histogram.resize(entry.depth + 1);
+				rep.depth_histogram[entry.depth]++;
+				rep.max_depth = std::max(rep.max_depth, entry.depth);
+				
+				const double area = node.bbox.surface_area() / root_area;
+				
+				if(node.leaf) {
+					rep.leaf_count++;
+					if(rep.leaf_histogram.size() <= node.right) rep.leaf_histogram.resize(node.right + 1);
+					rep.leaf_histogram[node.right]++;
+					rep.sah_cost += area * (1 + node.right);
+				} else {
+					rep.sah_cost += area;
+					
+					const double node_area = node.bbox.surface_area();
+					if(node_area > 0)
+						overlap_sum += aabb_intersection(tree[node.left].bbox, tree[node.right].bbox).surface_area() / node_area;
+					
+					stack.push_back({node.left,  entry.depth + 1});
+					stack.push_back({node.right, entry.depth + 1});
+				}
+			}
+			
+			const size_t inner_count = rep.node_count - rep.leaf_count;
+			rep.overlap_ratio = inner_count ? overlap_sum / inner_count : 0;
+			return rep;
+		}
+		
+		// Moves the nodes into 'order', the root stays first and children
+		// still come after their parent
+		// An adopted tree is copied into 'nodes' first.
+		void reorder(BVH_Order order) {
+			if(tree_size == 0) return;
+			
+			// Levels below each node, children have larger indices
+			std::vector<uint32_t> height(tree_size, 1);
+			for(size_t i = tree_size; i-- > 0;) {
+				const BVH_node& node = tree[i];
+				if(!node.leaf) height[i] = 1 + std::max(height[node.left], height[node.right]);
+			}
+			
+			std::vector<uint32_t> sequence;
+			sequence.reserve(tree_size);
+			if(order == ORDER_VAN_EMDE_BOAS)
+				layout_vEB(0, height[0], sequence);
+			else
+				layout_depth_first(sequence);
+			
+			std::vector<uint32_t> new_index(tree_size);
+			for(size_t i = 0; i < tree_size; i++)
+				new_index[sequence[i]] = i;
+			
+			std::vector<BVH_node> reordered(tree_size);
+			for(size_t i = 0; i < tree_size; i++) {
+				BVH_node node = tree[sequence[i]];
+				if(!node.leaf) {
+					node.left  = new_index[node.left];
+					node.right = new_index[node.right];
+				}
+				reordered[i] = node;
+			}
+			
+			nodes.swap(reordered);
+			tree = nodes.data();
+			tree_storage.reset();
+		}
+		
+		// Register without the repeats, in first-seen order
+		// A tree with spatial splits (SBVH) references some primitives from several leaves.
+		std::vector<std::shared_ptr<IHittable>> unique_primitives() const {
+			std::vector<std::shared_ptr<IHittable>> objects;
+			objects.reserve(primitives_register.size());
+			std::unordered_set<const IHittable*> seen;
+			for(const auto& obj : primitives_register)
+				if(seen.insert(obj.get()).second) objects.push_back(obj);
+			return objects;
+		}
+		
+		// Rebuilds over the same primitives from their current bounds,
+		// e.g. a TLAS after some of its instances moved
+		// A tree with spatial splits is rebuilt without them, each primitive in one leaf.
+		void rebuild() {
+			std::vector<std::shared_ptr<IHittable>> objects = unique_primitives();
+			primitives_register.clear();
+			split_references = false;
+			nodes.clear();
+			build_times = BVH_build_times();
+			tree_storage.reset();
+			build(objects);
+		}
+		
+		// Updates the node bounds from the current primitive bounds, keeping the topology
+		// Much cheaper than rebuild() for small motions between frames, but the
+		// tree degrades as primitives drift away from their neighbours.
+		// An adopted tree is copied into 'nodes' first.
+		// The clipped leaf bounds of spatial splits can't be refitted, such a tree is rebuilt.
+		void refit() {
+			if(tree_size == 0) return;
+			if(split_references) {
+				rebuild();
+				return;
+			}
+			
+			if(tree != nodes.data()) {
+				nodes.assign(tree, tree + tree_size);
+				tree = nodes.data();
+				tree_storage.reset();
+			}
+			
+			// Children have larger indices, so they are done before their parent
+			for(size_t i = tree_size; i-- > 0;) {
+				BVH_node& node = nodes[i];
+				if(node.leaf) {
+					node.bbox = AABB::empty;
+					for(uint32_t p = node.left; p < node.left + node.right; p++)
+						node.bbox = AABB(node.bbox, shutter_bounds(*primitives_register[p]));
+				} else
+					node.bbox = AABB(nodes[node.left].bbox, nodes[node.right].bbox);
+			}
 		}
 		
 		AABB bounding_box() const override {
-			if (nodes.empty()) return AABB::empty;
-			return nodes[0].bbox; // root node’s bbox covers the whole BVH
+			if (tree_size == 0) return AABB::empty;
+			return tree[0].bbox; // root node’s bbox covers the whole BVH
+		}
+		
+		
+		// Preorder, left child first
+		void layout_depth_first(std::vector<uint32_t>& sequence) const {
+			std::vector<uint32_t> stack = {0};
+			while(!stack.empty()) {
+				uint32_t idx = stack.back();
+				stack.pop_back();
+				sequence.push_back(idx);
+				if(!tree[idx].leaf) {
+					stack.push_back(tree[idx].right);
+					stack.push_back(tree[idx].left);
+				}
+			}
+		}
+		
+		// Lays out the 'levels' top levels of the subtree at 'root':
+		// the top half first, then each subtree hanging below it.
+		// Any run of consecutive levels then spans few cache lines and pages,
+		// whatever their size.
+		void layout_vEB(uint32_t root, uint32_t levels, std::vector<uint32_t>& sequence) const {
+			if(levels == 1 || tree[root].leaf) {
+				sequence.push_back(root);
+				return;
+			}
+			
+			const uint32_t top = levels / 2;
+			layout_vEB(root, top, sequence);
+			
+			// Roots of the bottom trees, 'top' levels below 'root'
+			struct Entry {uint32_t idx, depth;};
+			std::vector<Entry> stack = {{root, 0}};
+			std::vector<uint32_t> bottom_roots;
+			while(!stack.empty()) {
+				const Entry entry = stack.back();
+				stack.pop_back();
+				if(entry.depth == top) {
+					bottom_roots.push_back(entry.idx);
+					continue;
+				}
+				const BVH_node& node = tree[entry.idx];
+				if(node.leaf) continue;
+				stack.push_back({node.right, entry.depth + 1});
+				stack.push_back({node.left,  entry.depth + 1});
+			}
+			
+			for(uint32_t bottom_root : bottom_roots)
+				layout_vEB(bottom_root, levels - top, sequence);
 		}
-
 		
 		// brain crumbles beyond this point.
 		uint32_t construct(
@@ -130,7 +439,7 @@ class LBVH : public IHittable {
 		}
 		
 		bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
-			if(nodes.empty()) return false;
+			if(tree_size == 0) return false;
 			
 			bool got_hit = false;
 			uint32_t stack[64];
@@ -141,14 +450,17 @@ class LBVH : public IHittable {
 			
 			while(sp > 0) {
 				uint32_t idx = stack[--sp];
-				const BVH_node& node = nodes[idx];
+				const BVH_node& node = tree[idx];
 				
+				STAT(nodes);
+				STAT(aabb_tests);
 				if(!node.bbox.hit(r, ray_t)) continue;
 				
 				if(node.leaf) {
 					uint32_t offset = node.left;
 					uint32_t count  = node.right;
 					
+					STAT_ADD(prim_tests, count);
 					for(uint32_t i = 0; i < count; i++) {
 						if(primitives_register[offset+i]->hit(r, ray_t, rec)) {
 							got_hit = true;
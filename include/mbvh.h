@@ -0,0 +1,207 @@
+#ifndef MBVH_H
+#define MBVH_H
+
+#include "defs.h"
+#include "lbvh.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+// Motion BVH node: bounds at both ends of its time segment, min[3] then max[3],
+// rounded outwards to float so a node fits in a cache line
+struct alignas(64) MBVH_node {
+	float	 bounds[2][6];
+	uint32_t left, right;		// As in BVH_node
+	uint8_t	 axis;
+	bool	 leaf;
+};
+
+static_assert(sizeof(MBVH_node) == 64, "MBVH node must be 64 bytes");
+
+// BVH whose nodes follow the motion of their primitives over the shutter
+// Each node keeps its bounds at both ends of its time segment, and a ray tests
+// them interpolated to its own time. A fast moving sphere then only fills
+// its box at the ray's time, instead of the whole swept box.
+// Interpolating bounds is exact for primitives moving linearly, as moving
+// spheres and Animated objects do over a frame; see IHittable::time_bounds().
+// Incoherent motion still pulls siblings apart away from the time the tree
+// was built for, so the shutter can be split into segments, each with its
+// own tree built over its part of the shutter (temporal splits).
+// Per ray on fast spheres moving in random directions (bench motion),
+// swept LBVH / 1 segment / 4 segments / static LBVH:
+//	1K		1120 / 1150 / 860 / 660 ns
+//	10K		3630 / 3170 / 1760 / 990 ns
+//	100K	31 / 21 / 5.6-8 / 2 us
+// One segment keeps the topology built from swept boxes; building it from
+// mid-shutter bounds measured no faster, so the segments are what pays.
+// 4 is the default, 8 and 16 were no faster.
+class MBVH : public IHittable {
+	private:
+		// Segment s covers times [s, s+1] / segments, its tree starts at roots[s]
+		std::vector<MBVH_node> nodes;
+		std::vector<uint32_t> roots;
+		int segments = 1;
+		std::vector<std::shared_ptr<IHittable>> primitives_register;
+		AABB bbox = AABB::empty;
+		
+		static float round_down(double x) {
+			float f = float(x);
+			return (f > x) ? std::nextafter(f, -std::numeric_limits<float>::infinity()) : f;
+		}
+		
+		static float round_up(double x) {
+			float f = float(x);
+			return (f < x) ? std::nextafter(f, std::numeric_limits<float>::infinity()) : f;
+		}
+		
+		// Bounds at both ends of a segment, rounded outwards to float, and moved
+		// out by the error of interpolating them in float at a float 'time'
+		// (at most gamma_4 of |lo0| + |lo1|), so box_hit() needs no widening of its own
+		static void write(const AABB& box_0, const AABB& box_1, MBVH_node& node) {
+			for(int a = 0; a < 3; a++) {
+				const interval& i0 = box_0.axis_interval(a);
+				const interval& i1 = box_1.axis_interval(a);
+				const double lo_slack = gamma_n<float>(5) * (std::fabs(i0.min) + std::fabs(i1.min));
+				const double hi_slack = gamma_n<float>(5) * (std::fabs(i0.max) + std::fabs(i1.max));
+				
+				node.bounds[0][a]	= round_down(i0.min - lo_slack);
+				node.bounds[1][a]	= round_down(i1.min - lo_slack);
+				node.bounds[0][a+3] = round_up(i0.max + hi_slack);
+				node.bounds[1][a+3] = round_up(i1.max + hi_slack);
+			}
+		}
+		
+		// Slab test against the node bounds at 'time', in float, conservative:
+		// see write() for the interpolation, and QBVH::box_hit() for the slabs
+		static bool box_hit(const MBVH_node& node, float time, const Ray_Slabs& slabs, float t_min, float t_max) {
+			for(int a = 0; a < 3; a++) {
+				const float lo = node.bounds[0][a]	 + time * (node.bounds[1][a]   - node.bounds[0][a]);
+				const float hi = node.bounds[0][a+3] + time * (node.bounds[1][a+3] - node.bounds[0][a+3]);
+				
+				const bool flip = slabs.inv_dir[a] < 0;
+				const float t0 = ((flip ? hi : lo) - slabs.near_orig[a]) * slabs.inv_dir[a];
+				const float t1 = ((flip ? lo : hi) - slabs.far_orig[a])	 * slabs.inv_dir[a];
+				
+				t_min = std::max(t0, t_min);
+				t_max = std::min(t1 + std::fabs(t1) * (2 * gamma_n<float>(3)), t_max);
+			}
+			return t_min <= t_max;
+		}
+		
+		// Appends the tree of 'bvh', its indices shifted past what is already there
+		void append(const LBVH& bvh) {
+			const uint32_t node_offset = nodes.size();
+			const uint32_t prim_offset = primitives_register.size();
+			const BVH_node* tree = bvh.tree_nodes();
+			
+			roots.push_back(node_offset);
+			for(size_t i = 0; i < bvh.tree_node_count(); i++) {
+				MBVH_node node;
+				node.leaf  = tree[i].leaf;
+				node.axis  = tree[i].axis;
+				node.left  = tree[i].left + (node.leaf ? prim_offset : node_offset);
+				node.right = tree[i].right + (node.leaf ? 0 : node_offset);
+				nodes.push_back(node);
+			}
+			primitives_register.insert(primitives_register.end(), bvh.primitives().begin(), bvh.primitives().end());
+		}
+	
+	public:
+		// Same topology and primitives as 'bvh', one segment
+		MBVH(const LBVH& bvh) {
+			append(bvh);
+			roots.push_back(nodes.size());
+			refit();
+		}
+		
+		static constexpr int default_segments = 4;
+		
+		// One tree per segment, each built over its part of the shutter
+		MBVH(const std::vector<std::shared_ptr<IHittable>>& objects, int segments = default_segments) : segments(std::max(segments, 1)) {
+			for(int s = 0; s < this->segments; s++)
+				append(LBVH(objects, interval(double(s) / this->segments, double(s + 1) / this->segments)));
+			roots.push_back(nodes.size());
+			refit();
+		}
+		
+		// Updates the bounds from the current primitive bounds, keeping the topology
+		// e.g. once Animated objects have been moved to the next frame
+		void refit() {
+			bbox = AABB::empty;
+			std::vector<AABB> box_0(nodes.size()), box_1(nodes.size());
+			
+			for(int s = 0; s < segments; s++) {
+				if(roots[s] == roots[s+1]) continue;
+				const double time_0 = double(s) / segments;
+				const double time_1 = double(s + 1) / segments;
+				
+				// Children have larger indices, so they are done before their parent
+				for(size_t i = roots[s+1]; i-- > roots[s];) {
+					MBVH_node& node = nodes[i];
+					if(node.leaf) {
+						box_0[i] = box_1[i] = AABB::empty;
+						for(uint32_t p = node.left; p < node.left + node.right; p++) {
+							box_0[i] = AABB(box_0[i], primitives_register[p] -> time_bounds(time_0));
+							box_1[i] = AABB(box_1[i], primitives_register[p] -> time_bounds(time_1));
+						}
+					} else {
+						box_0[i] = AABB(box_0[node.left], box_0[node.right]);
+						box_1[i] = AABB(box_1[node.left], box_1[node.right]);
+					}
+					
+					write(box_0[i], box_1[i], node);
+				}
+				
+				bbox = AABB(bbox, AABB(box_0[roots[s]], box_1[roots[s]]));
+			}
+		}
+		
+		size_t node_count() const {return nodes.size();}
+		int segment_count() const {return segments;}
+		
+		AABB bounding_box() const override {return bbox;}
+		
+		bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+			// Segment of the ray, and its time within it
+			const double shutter = std::min(std::max(r.time(), 0.), 1.) * segments;
+			const int s = std::min(int(shutter), segments - 1);
+			const float time = shutter - s;
+			if(roots[s] == roots[s+1]) return false;
+			
+			const Ray_Slabs slabs(r);
+			
+			bool got_hit = false;
+			uint32_t stack[64];
+			int sp = 0;
+			stack[sp++] = roots[s];
+			
+			while(sp > 0) {
+				const MBVH_node& node = nodes[stack[--sp]];
+				
+				STAT(nodes);
+				STAT(aabb_tests);
+				if(!box_hit(node, time, slabs, ray_t.min, ray_t.max)) continue;
+				
+				if(node.leaf) {
+					STAT_ADD(prim_tests, node.right);
+					for(uint32_t i = 0; i < node.right; i++) {
+						if(primitives_register[node.left + i]->hit(r, ray_t, rec)) {
+							got_hit = true;
+							ray_t.max = rec.t;
+						}
+					}
+				} else if(slabs.inv_dir[node.axis] < 0) {
+					stack[sp++] = node.left;
+					stack[sp++] = node.right;
+				} else {
+					stack[sp++] = node.right;
+					stack[sp++] = node.left;
+				}
+			}
+			
+			return got_hit;
+		}
+};
+
+#endif
\ No newline at end of file
@@ -0,0 +1,247 @@
+#ifndef QBVH_H
+#define QBVH_H
+
+#include "defs.h"
+#include "lbvh.h"
+
+#include <cmath>
+
+struct QBVH_leaf {
+	uint32_t first, count;
+};
+
+// Compressed BVH node
+// An inner node holds the boxes of its two children, quantized to 8 or 16 bits
+// per plane relative to its own decoded box, so one fetch is enough to test both.
+// 4 (8-bit) or 2 (16-bit) nodes share a cache line.
+template<typename Q>
+struct alignas(sizeof(Q) == 1 ? 16 : 32) QBVH_node {
+	union {
+		Q		  bounds[2][6];		// Per child: min[3] then max[3]
+		QBVH_leaf leaf;
+	};
+	uint32_t children;				// First of two adjacent children, 0 for leaves (never a child)
+};
+
+static_assert(sizeof(QBVH_node<uint8_t>)  == 16, "8-bit QBVH node must be 16 bytes");
+static_assert(sizeof(QBVH_node<uint16_t>) == 32, "16-bit QBVH node must be 32 bytes");
+
+// Quantized LBVH, read-only, converted from an existing LBVH
+// Decoding is conservative: a decoded box always contains the original one.
+// It trades speed for memory: 4x (8-bit) or 2x (16-bit) smaller than the LBVH
+// nodes, but slower to trace in the bench at every size so far (e.g. QBVH8
+// 1000 vs 710 ns at 1K primitives, 2510 vs 2310 ns at 100K), as decoding
+// costs more than the fetches it saves while the tree fits in cache.
+template<typename Q>
+class QBVH : public IHittable {
+	private:
+		static constexpr float q_max = float(Q(~Q(0)));
+		
+		// Steps are widened a little so the top code always reaches the end
+		// of the frame despite float rounding
+		static constexpr float step_scale = (1 + 1e-6f) / q_max;
+		
+		std::vector<QBVH_node<Q>> nodes;
+		std::vector<std::shared_ptr<IHittable>> primitives_register;
+		
+		// Box of the root node, rounded outwards to float
+		// Frames are min[3] then max[3]
+		float root_frame[6];
+		AABB bbox;
+		
+		static void decode(const Q* q, const float* frame, float* box) {
+			for(int a = 0; a < 3; a++) {
+				const float step = (frame[a+3] - frame[a]) * step_scale;
+				box[a]	 = frame[a] + float(q[a])   * step;
+				box[a+3] = frame[a] + float(q[a+3]) * step;
+			}
+		}
+		
+		static void encode(const AABB& box, const float* frame, Q* q) {
+			for(int a = 0; a < 3; a++) {
+				const interval& ax = box.axis_interval(a);
+				const float step = (frame[a+3] - frame[a]) * step_scale;
+				
+				if(!(step > 0)) {
+					q[a]   = 0;
+					q[a+3] = Q(q_max);
+					continue;
+				}
+				
+				double lo = std::floor((ax.min - frame[a]) / step);
+				double hi = std::ceil ((ax.max - frame[a]) / step);
+				int qlo = int(std::max(0., std::min(lo, double(q_max))));
+				int qhi = int(std::max(0., std::min(hi, double(q_max))));
+				
+				// Nudged until the decoded planes enclose the box
+				while(qlo > 0 && frame[a] + float(qlo) * step > ax.min) qlo--;
+				while(qhi < q_max && frame[a] + float(qhi) * step < ax.max) qhi++;
+				
+				q[a]   = Q(qlo);
+				q[a+3] = Q(qhi);
+			}
+		}
+		
+		static float round_down(double x) {
+			float f = float(x);
+			return (f > x) ? std::nextafter(f, -std::numeric_limits<float>::infinity()) : f;
+		}
+		
+		static float round_up(double x) {
+			float f = float(x);
+			return (f < x) ? std::nextafter(f, std::numeric_limits<float>::infinity()) : f;
+		}
+		
+		// Slab test against a decoded box, in float, conservative:
+		// the origin is rounded outwards per slab (see Ray_Slabs in utils/ray.h), and the far
+		// distance is widened by 2 gamma_3 of its magnitude, which covers the
+		// rounding of the subtraction, the product and inv_dir on both distances
+		static bool box_hit(const float* box, const Ray_Slabs& slabs, float t_min, float t_max, float& t) {
+			for(int a = 0; a < 3; a++) {
+				const int near = (slabs.inv_dir[a] < 0) ? 3 : 0;
+				const float t0 = (box[a + near]		- slabs.near_orig[a]) * slabs.inv_dir[a];
+				const float t1 = (box[a + 3 - near] - slabs.far_orig[a])  * slabs.inv_dir[a];
+				
+				t_min = std::max(t0, t_min);
+				t_max = std::min(t1 + std::fabs(t1) * (2 * gamma_n<float>(3)), t_max);
+			}
+			t = t_min;
+			return t_min <= t_max;
+		}
+	
+	public:
+		QBVH(const LBVH& bvh) : primitives_register(bvh.primitives()) {
+			const BVH_node* tree = bvh.tree_nodes();
+			const size_t tree_size = bvh.tree_node_count();
+			if(tree_size == 0) {
+				bbox = AABB::empty;
+				return;
+			}
+			
+			bbox = tree[0].bbox;
+			for(int a = 0; a < 3; a++) {
+				root_frame[a]	= round_down(bbox.axis_interval(a).min);
+				root_frame[a+3] = round_up(bbox.axis_interval(a).max);
+			}
+			
+			// Same tree, with siblings moved next to each other
+			nodes.reserve(tree_size);
+			nodes.emplace_back();
+			
+			struct Entry {uint32_t idx, src; float frame[6];};
+			std::vector<Entry> stack(1);
+			stack[0].idx = 0;
+			stack[0].src = 0;
+			std::copy(root_frame, root_frame + 6, stack[0].frame);
+			
+			while(!stack.empty()) {
+				Entry entry = stack.back();
+				stack.pop_back();
+				
+				const BVH_node& src = tree[entry.src];
+				
+				if(src.leaf) {
+					nodes[entry.idx].leaf = {src.left, src.right};
+					nodes[entry.idx].children = 0;
+					continue;
+				}
+				
+				const uint32_t children = nodes.size();
+				nodes.emplace_back();
+				nodes.emplace_back();
+				
+				QBVH_node<Q>& node = nodes[entry.idx];
+				node.children = children;
+				
+				const uint32_t src_children[2] = {src.left, src.right};
+				for(int c = 0; c < 2; c++) {
+					Entry child;
+					child.idx = children + c;
+					child.src = src_children[c];
+					
+					// Children are encoded in the decoded frame of their parent
+					encode(tree[child.src].bbox, entry.frame, node.bounds[c]);
+					decode(node.bounds[c], entry.frame, child.frame);
+					stack.push_back(child);
+				}
+			}
+		}
+		
+		size_t node_count() const {return nodes.size();}
+		
+		size_t memory_bytes() const {
+			return nodes.size() * sizeof(QBVH_node<Q>)
+				 + primitives_register.capacity() * sizeof(std::shared_ptr<IHittable>);
+		}
+		
+		AABB bounding_box() const override {return bbox;}
+		
+		bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+			if(nodes.empty()) return false;
+			
+			const Ray_Slabs slabs(r);
+			
+			// Boxes are tested by the parent, entries keep the decoded box
+			// as the frame of their own children
+			struct Entry {uint32_t idx; float t; float frame[6];};
+			Entry stack[64];
+			int sp = 0;
+			
+			STAT(aabb_tests);
+			float t_root;
+			if(!box_hit(root_frame, slabs, ray_t.min, ray_t.max, t_root)) return false;
+			stack[sp].idx = 0;
+			stack[sp].t = t_root;
+			std::copy(root_frame, root_frame + 6, stack[sp].frame);
+			sp++;
+			
+			bool got_hit = false;
+			
+			while(sp > 0) {
+				// The slot is reused by the pushes below, once both boxes are decoded
+				const Entry& entry = stack[--sp];
+				if(entry.t > ray_t.max) continue;
+				
+				const QBVH_node<Q>& node = nodes[entry.idx];
+				STAT(nodes);
+				
+				if(node.children == 0) {
+					STAT_ADD(prim_tests, node.leaf.count);
+					for(uint32_t i = 0; i < node.leaf.count; i++) {
+						if(primitives_register[node.leaf.first + i]->hit(r, ray_t, rec)) {
+							got_hit = true;
+							ray_t.max = rec.t;
+						}
+					}
+					continue;
+				}
+				
+				float box[2][6];
+				float t[2];
+				bool h[2];
+				STAT_ADD(aabb_tests, 2);
+				for(int c = 0; c < 2; c++) {
+					decode(node.bounds[c], entry.frame, box[c]);
+					h[c] = box_hit(box[c], slabs, ray_t.min, ray_t.max, t[c]);
+				}
+				
+				// Nearest child is popped first
+				int near = (h[1] && (!h[0] || t[1] < t[0])) ? 1 : 0;
+				for(int k = 0; k < 2; k++) {
+					int c = (k == 0) ? 1 - near : near;
+					if(!h[c]) continue;
+					stack[sp].idx = node.children + c;
+					stack[sp].t = t[c];
+					std::copy(box[c], box[c] + 6, stack[sp].frame);
+					sp++;
+				}
+			}
+			
+			return got_hit;
+		}
+};
+
+typedef QBVH<uint8_t>  QBVH8;
+typedef QBVH<uint16_t> QBVH16;
+
+#endif
\ No newline at end of file
@@ -0,0 +1,67 @@
+#ifndef RENDER_FARM_H
+#define RENDER_FARM_H
+
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+#include "defs.h"
+#include "utils/float_image.h"
+
+// Local multi-process rendering
+// The coordinator starts worker processes (the same executable, given --worker),
+// each connected by a socket pair. Workers receive the scene tables once and
+// the view of each frame, then render tiles handed out one at a time as they finish.
+// Tiles are seeded by their position, so results do not depend on which
+// worker renders them; the tile of a worker that fails or stalls is given to another.
+
+// View and quality of a frame
+struct Render_Job {
+	double	 eye[3], focus[3], up[3];
+	double	 background[3];
+	double	 fov;
+	int32_t	 width, height;
+	int32_t	 max_bounces;
+	int32_t	 samples;			// SAMPLING_MODE only
+	uint64_t seed;
+};
+
+struct Render_Tile {
+	int32_t x0, y0, x1, y1;
+	
+	size_t size() const {return size_t(x1 - x0) * (y1 - y0);}
+};
+
+class Render_Farm {
+	private:
+		struct Worker {
+			int	 fd;
+			int	 pid;
+			int	 tile;				// Index of the tile in progress, -1 if idle
+			std::chrono::steady_clock::time_point deadline;		// For the tile in progress
+		};
+		
+		std::vector<Worker> workers;
+		int tile_timeout_ms;
+		
+		// Closes the connection and reaps the process, killed first if 'failed'
+		void drop(size_t w, bool failed);
+	
+	public:
+		// Starts 'count' copies of 'exe' and sends them 'scene'
+		// A worker not done with a tile after 'tile_timeout_ms' is killed and its tile
+		// handed out again; the first tile also waits for the worker's BVH build.
+		Render_Farm(const char* exe, int count, const Scene_Writer& scene, int tile_timeout_ms = 60000);
+		~Render_Farm();
+		
+		size_t alive() const {return workers.size();}
+		
+		// Renders the job into 'frame' (3 planes), in tiles of 'tile_size' pixels square
+		// Fails only once every worker is gone
+		bool render(Float_Image& frame, const Render_Job& job, int tile_size = 32);
+};
+
+// Entry point of a worker process, serving the coordinator on 'fd'
+int farm_worker(int fd);
+
+#endif
\ No newline at end of file
@@ -0,0 +1,110 @@
+#ifndef RESOLVE_H
+#define RESOLVE_H
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <omp.h>
+
+#include "utils/float_image.h"
+
+enum Tonemap {
+	TONEMAP_CLAMP,
+	TONEMAP_REINHARD,
+	TONEMAP_ACES		// Narkowicz 2015 fit of the ACES filmic curve
+};
+
+// Converts 3 HDR planes to ARGB8888 in bulk
+// Exposure and tonemapping run branch-free over blocks of pixels, so they vectorize,
+// and end in a square root (gamma 2); a small table then maps that to the output
+// gamma and to bytes, without banding in the darks.
+class Resolver {
+	private:
+		static constexpr int lut_size = 4096;
+		static constexpr size_t block = 256;
+		
+		uint8_t lut[lut_size];
+		float lut_gamma = 0;		// Gamma 'lut' was built for
+		
+		void build_lut() {
+			for(int i = 0; i < lut_size; i++) {
+				const double v = double(i) / (lut_size - 1);
+				lut[i] = uint8_t(255 * std::pow(v * v, 1. / gamma) + .5);
+			}
+			lut_gamma = gamma;
+		}
+		
+		template<int T>
+		static float map(float x) {
+			switch(T) {
+				case TONEMAP_REINHARD:
+					return x / (1.f + x);
+				case TONEMAP_ACES:
+					return (x * (2.51f * x + .03f)) / (x * (2.43f * x + .59f) + .14f);
+				default:
+					return x;
+			}
+		}
+		
+		template<int T>
+		void resolve(const Float_Image& hdr, uint32_t* out) const {
+			const size_t N = hdr.size();
+			const float scale = std::exp2(exposure);
+			const float to_index = lut_size - 1;
+			
+			#pragma omp parallel for
+			for(size_t start = 0; start < N; start += block) {
+				const size_t n = std::min(size_t(block), N - start);
+				uint16_t index[3][block];
+				
+				for(int c = 0; c < 3; c++) {
+					const float* in = hdr.plane(c) + start;
+					uint16_t* idx = index[c];
+					
+					#pragma omp simd
+					for(size_t i = 0; i < n; i++) {
+						const float v = std::min(std::max(map<T>(in[i] * scale), 0.f), 1.f);
+						idx[i] = uint16_t(std::sqrt(v) * to_index + .5f);
+					}
+				}
+				
+				for(size_t i = 0; i < n; i++)
+					out[start + i] = (uint32_t(lut[index[0][i]]) << 16)
+								   | (uint32_t(lut[index[1][i]]) << 8)
+								   |  uint32_t(lut[index[2][i]]);
+			}
+		}
+	
+	public:
+		Tonemap tonemap = TONEMAP_CLAMP;
+		float exposure = 0;		// In stops
+		float gamma = 2;
+		
+		// Duration of the last run, in milliseconds
+		double last_ms = 0;
+		
+		// 'hdr' holds 3 linear planes, 'out' one pixel per texel
+		void run(const Float_Image& hdr, uint32_t* out) {
+			auto start_time = std::chrono::steady_clock::now();
+			
+			if(gamma != lut_gamma) build_lut();
+			
+			switch(tonemap) {
+				case TONEMAP_REINHARD:
+					resolve<TONEMAP_REINHARD>(hdr, out);
+					break;
+				case TONEMAP_ACES:
+					resolve<TONEMAP_ACES>(hdr, out);
+					break;
+				default:
+					resolve<TONEMAP_CLAMP>(hdr, out);
+					break;
+			}
+			
+			auto end_time = std::chrono::steady_clock::now();
+			last_ms = std::chrono::duration<double, std::milli>(end_time - start_time).count();
+		}
+};
+
+#endif
\ No newline at end of file
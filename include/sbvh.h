@@ -0,0 +1,35 @@
+#ifndef SBVH_H
+#define SBVH_H
+
+#include "defs.h"
+#include "lbvh.h"
+
+// Spatial-split BVH builder
+// Besides the usual object splits, a node may be cut by a plane: primitives
+// crossing it are then referenced on both sides, each reference bounded by
+// the part of the primitive on its side (IHittable::clip_bounds).
+// Large primitives such as walls stop covering every node, at the cost of
+// some duplicated references.
+// The result is a regular LBVH, whose register holds the duplicates.
+
+struct SBVH_params {
+	// Extra references allowed, relative to the primitive count
+	double duplication_budget = .3;
+	
+	// Spatial splits are only tried where the children of the best object split
+	// overlap by more than this fraction of the root area
+	double overlap_threshold = 1e-5;
+	
+	int bins = 32;
+};
+
+class SBVH {
+	public:
+		static shared_ptr<LBVH> build(const std::vector<shared_ptr<IHittable>>& objects, const SBVH_params& params = SBVH_params());
+		
+		static shared_ptr<LBVH> build(const hittable_list& list, const SBVH_params& params = SBVH_params()) {
+			return build(list.objects, params);
+		}
+};
+
+#endif
\ No newline at end of file
@@ -0,0 +1,75 @@
+#ifndef SCENE_CACHE_H
+#define SCENE_CACHE_H
+
+#include "defs.h"
+#include "lbvh.h"
+
+// Versioned binary scene cache
+// Holds the texture, material and primitive tables of a scene and the
+// flattened LBVH built over it. Sections are 64-byte aligned so the
+// BVH_node array is used in place from the mapped file.
+// The header keeps a hash of the tables and of the build configuration,
+// a cache written for another scene content, another builder or node order
+// (or another format version) is ignored.
+// It also keeps a key of the scene's recipe (e.g. generator parameters)
+// and of the executable, so load_scene() can rebuild the scene from the
+// tables instead of running the generator again.
+
+// How the cached tree was built, see Scene_Cache::build_config()
+enum BVH_Builder {
+	BUILDER_LBVH,
+	BUILDER_SBVH
+};
+
+struct Cache_Header {
+	char	 magic[8];
+	uint32_t version;
+	uint32_t node_size;			// sizeof(BVH_node), guards layout changes
+	uint64_t content_hash;		// Tables and build configuration
+	uint64_t recipe;			// 0 if saved without one
+	uint32_t build;
+	uint32_t pad;
+	
+	// Sections, in file order
+	enum {TEXTURES, MATERIALS, PRIMITIVES, ROOTS, REGISTER, NODES, NAMES, SECTION_COUNT};
+	uint64_t offset[SECTION_COUNT];
+	uint64_t count[SECTION_COUNT];
+};
+
+class Scene_Cache {
+	public:
+		static constexpr uint32_t version = 2;
+		
+		static uint32_t build_config(BVH_Builder builder, BVH_Order order) {
+			return uint32_t(builder) | (uint32_t(order) << 8);
+		}
+		
+		// Key of a scene recipe, a string naming the scene function and its parameters
+		// The key also hashes the running executable, so any rebuild of the program
+		// (e.g. an edited scene function) invalidates the caches loaded by recipe.
+		// 0, so nothing loads by recipe, if the executable can't be read.
+		static uint64_t recipe_key(const std::string& recipe);
+		
+		// Records of a scene, in the order of its objects
+		static Scene_Writer describe(const hittable_list& scene);
+		
+		// Writes 'bvh', built over 'scene' with 'build', to 'path'
+		// Fails if a primitive type has no record
+		static bool save(const char* path, const hittable_list& scene, const LBVH& bvh, uint32_t build, uint64_t recipe = 0);
+		
+		// Maps 'path' if it was written for the same scene content and build,
+		// its primitives are then shared with 'scene'
+		// Returns nullptr otherwise
+		static shared_ptr<LBVH> load(const char* path, const hittable_list& scene, uint32_t build);
+		
+		// Maps 'path' if it was written for the same recipe and build, without
+		// the scene: its objects are rebuilt from the tables into 'scene'
+		// Returns nullptr otherwise, 'scene' is then left untouched
+		static shared_ptr<LBVH> load_scene(const char* path, uint64_t recipe, uint32_t build, hittable_list& scene);
+		
+		// Rebuilds the objects described by 'w',
+		// one per entry of 'w.roots'
+		static std::vector<shared_ptr<IHittable>> instantiate(const Scene_Writer& w);
+};
+
+#endif
\ No newline at end of file
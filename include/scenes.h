@@ -0,0 +1,48 @@
+#ifndef SCENES_H
+#define SCENES_H
+
+#include "defs.h"
+
+// Spatial distribution of a generated scene
+enum Scene_Layout {
+	LAYOUT_UNIFORM,		// Filled cube
+	LAYOUT_CLUSTERED,	// Gaussian blobs of uneven sizes
+	LAYOUT_LONG_THIN	// Long, thin slab along x
+};
+
+struct generator_params {
+	size_t		 count			 = 1000;
+	Scene_Layout layout			 = LAYOUT_UNIFORM;
+	uint64_t	 seed			 = 1;
+	double		 extent			 = 100;		// Half-size of the scene along its longest axis
+	double		 quad_fraction	 = .2;
+	double		 volume_fraction = .01;
+	size_t		 cluster_count	 = 64;
+};
+
+// Keyframes of an animated scene, times in seconds
+struct Animation {
+	Track<point3> eye, focus;
+	std::vector<shared_ptr<Animated>> objects;		// Placed by set_shutter() each frame
+	double fps		= 24;
+	double shutter	= .5;		// Open fraction of a frame (180 degrees)
+	double duration = 4;
+};
+
+// Built-in scenes, objects are added to 'scene'
+// Shared by the renderer and the benchmarks
+
+void scene_origScene(hittable_list& scene);
+void scene_bookScene(hittable_list& scene);
+void scene_earthScene(hittable_list& scene);
+void scene_cornellScene(hittable_list& scene, float dim);
+void scene_meshScene(hittable_list& scene, const char* obj_filename);
+void scene_instanceScene(hittable_list& scene);
+void scene_smokeScene(hittable_list& scene, float dim);
+void scene_animatedScene(hittable_list& scene, Animation& anim, float dim);
+
+// Adds 'params.count' spheres, quads and volumes, sized to the layout density
+// Same parameters give the same scene, whatever the thread count
+void scene_generatedScene(hittable_list& scene, const generator_params& params);
+
+#endif
\ No newline at end of file
@@ -6,15 +6,28 @@
 #include <random>
 
 	
-// Get random double in [0,1[
-inline double get_rand_double(void) {
+// Per-thread generator, randomly seeded
+inline std::mt19937& rand_engine(void) {
 	thread_local static std::mt19937 gen = []{
         std::random_device rd;
         return std::mt19937(rd());
     }();
+	return gen;
+}
 
+// Get random double in [0,1[
+inline double get_rand_double(void) {
 	thread_local static std::uniform_real_distribution<> dis(0.0, 1.0); 
-	return dis(gen);
+	return dis(rand_engine());
+}
+
+// Restarts the sequence of this thread, for reproducible renders
+inline void seed_rand(uint64_t seed) {
+	// splitmix64 finalizer, so nearby seeds give unrelated sequences
+	seed += 0x9E3779B97F4A7C15ULL;
+	seed = (seed ^ (seed >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	seed = (seed ^ (seed >> 27)) * 0x94D049BB133111EBULL;
+	rand_engine().seed(uint32_t(seed ^ (seed >> 31)));
 }
 
 // Get random double in [min,max[
@@ -29,6 +42,17 @@ inline int get_rand_int(int min, int max) {
 
 
 constexpr double inf = std::numeric_limits<double>::infinity();
+
+// Unit roundoff of T, half its epsilon
+template<typename T>
+constexpr T machine_eps() {return std::numeric_limits<T>::epsilon() * T(.5);}
+
+// Relative error bound of n chained operations in T (Higham's gamma_n),
+// used to bound the error of computed intersection points
+// T is the type the bounded arithmetic runs in: a kernel moved to float
+// must bound its errors with gamma_n<float>
+template<typename T>
+constexpr T gamma_n(int n) {return (n * machine_eps<T>()) / (1 - n * machine_eps<T>());}
 constexpr float PI = 3.1415926535897;
 constexpr float TWO_PI = 2*PI;
 
@@ -36,10 +60,14 @@ inline double degrees_to_radians(double deg) {
 	return deg * (PI/180);
 }
 
+#include "utils/fastmath.h"
 #include "utils/vec3.h"
 #include "utils/color.h"
 #include "utils/ray.h"
 #include "utils/interval.h"
+#include "utils/affine.h"
+#include "utils/track.h"
+#include "utils/stats.h"
 
 
 #endif
\ No newline at end of file
@@ -0,0 +1,109 @@
+#ifndef AFFINE_H
+#define AFFINE_H
+
+#include "utils/vec3.h"
+
+// 3x4 affine transform, rows of [linear | translation]
+// The implied fourth row is (0, 0, 0, 1)
+class affine {
+	public:
+		double m[3][4];
+		
+		// Identity by default
+		affine() : m{{1, 0, 0, 0}, {0, 1, 0, 0}, {0, 0, 1, 0}} {}
+		
+		point3 point(const point3& p) const {
+			return point3(
+				m[0][0]*p[0] + m[0][1]*p[1] + m[0][2]*p[2] + m[0][3],
+				m[1][0]*p[0] + m[1][1]*p[1] + m[1][2]*p[2] + m[1][3],
+				m[2][0]*p[0] + m[2][1]*p[1] + m[2][2]*p[2] + m[2][3]
+			);
+		}
+		
+		vec3 vector(const vec3& v) const {
+			return vec3(
+				m[0][0]*v[0] + m[0][1]*v[1] + m[0][2]*v[2],
+				m[1][0]*v[0] + m[1][1]*v[1] + m[1][2]*v[2],
+				m[2][0]*v[0] + m[2][1]*v[1] + m[2][2]*v[2]
+			);
+		}
+		
+		// Normals go through the inverse transpose,
+		// so this is called on the inverse transform
+		vec3 normal_from_inverse(const vec3& n) const {
+			return vec3(
+				m[0][0]*n[0] + m[1][0]*n[1] + m[2][0]*n[2],
+				m[0][1]*n[0] + m[1][1]*n[1] + m[2][1]*n[2],
+				m[0][2]*n[0] + m[1][2]*n[1] + m[2][2]*n[2]
+			);
+		}
+		
+		affine inverse() const {
+			affine inv;
+			
+			// Adjugate of the linear part over its determinant
+			double c00 = m[1][1]*m[2][2] - m[1][2]*m[2][1];
+			double c01 = m[1][2]*m[2][0] - m[1][0]*m[2][2];
+			double c02 = m[1][0]*m[2][1] - m[1][1]*m[2][0];
+			double inv_det = 1. / (m[0][0]*c00 + m[0][1]*c01 + m[0][2]*c02);
+			
+			inv.m[0][0] = c00 * inv_det;
+			inv.m[1][0] = c01 * inv_det;
+			inv.m[2][0] = c02 * inv_det;
+			inv.m[0][1] = (m[0][2]*m[2][1] - m[0][1]*m[2][2]) * inv_det;
+			inv.m[1][1] = (m[0][0]*m[2][2] - m[0][2]*m[2][0]) * inv_det;
+			inv.m[2][1] = (m[0][1]*m[2][0] - m[0][0]*m[2][1]) * inv_det;
+			inv.m[0][2] = (m[0][1]*m[1][2] - m[0][2]*m[1][1]) * inv_det;
+			inv.m[1][2] = (m[0][2]*m[1][0] - m[0][0]*m[1][2]) * inv_det;
+			inv.m[2][2] = (m[0][0]*m[1][1] - m[0][1]*m[1][0]) * inv_det;
+			
+			// -A^-1 * t
+			for(int i = 0; i < 3; i++)
+				inv.m[i][3] = -(inv.m[i][0]*m[0][3] + inv.m[i][1]*m[1][3] + inv.m[i][2]*m[2][3]);
+			
+			return inv;
+		}
+		
+		static affine translate(const vec3& t) {
+			affine a;
+			a.m[0][3] = t[0];
+			a.m[1][3] = t[1];
+			a.m[2][3] = t[2];
+			return a;
+		}
+		
+		static affine scale(const vec3& s) {
+			affine a;
+			a.m[0][0] = s[0];
+			a.m[1][1] = s[1];
+			a.m[2][2] = s[2];
+			return a;
+		}
+		
+		// Angle in degrees, around one of the main axes
+		static affine rotate(int axis, double deg) {
+			affine a;
+			double rad = degrees_to_radians(deg);
+			double c = std::cos(rad), s = std::sin(rad);
+			int i = (axis + 1) % 3, j = (axis + 2) % 3;
+			a.m[i][i] =  c;
+			a.m[i][j] = -s;
+			a.m[j][i] =  s;
+			a.m[j][j] =  c;
+			return a;
+		}
+};
+
+// Applies 'b' first, then 'a'
+inline affine operator*(const affine& a, const affine& b) {
+	affine r;
+	for(int i = 0; i < 3; i++) {
+		for(int j = 0; j < 4; j++) {
+			r.m[i][j] = a.m[i][0]*b.m[0][j] + a.m[i][1]*b.m[1][j] + a.m[i][2]*b.m[2][j];
+			if(j == 3) r.m[i][j] += a.m[i][3];
+		}
+	}
+	return r;
+}
+
+#endif
\ No newline at end of file
@@ -10,4 +10,7 @@ using color = vec3;
 // Defined in utils.cpp
 uint32_t get_color(const color& pixel_color);
 
+// Binary PPM of ARGB8888 pixels
+bool write_ppm(const char* path, const uint32_t* pixels, int width, int height);
+
 #endif
\ No newline at end of file
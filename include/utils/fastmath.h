@@ -0,0 +1,123 @@
+#ifndef FASTMATH_H
+#define FASTMATH_H
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+
+// Float approximations of the libm calls made once per bounce
+// Branch-free and inline, so loops over them vectorize;
+// the _batch variants are such loops, over arrays of n values.
+// There is no fast_exp: under -ffast-math, glibc's expf already vectorizes in
+// simd loops and was faster in the denoiser. Bounds against libm, the bench
+// (math/...) fails past them:
+//	fast_log		~2.5 ulp, positive normal floats; 0 gives -inf
+//	fast_sincos		~1e-7 absolute, |a| < 2^20
+//	fast_acos		~6e-7 absolute, [-1, 1], clamped past it
+//	fast_atan2		~4e-7 absolute
+
+
+// floor(x) as an int, for |x| < 2^31, without a libm call
+inline int32_t fast_floor(float x) {
+	int32_t i = int32_t(x);
+	return i - int32_t(x < float(i));
+}
+
+inline uint32_t float_bits(float x) {
+	uint32_t bits;
+	memcpy(&bits, &x, sizeof(bits));
+	return bits;
+}
+
+inline float bits_float(uint32_t bits) {
+	float x;
+	memcpy(&x, &bits, sizeof(x));
+	return x;
+}
+
+// x = m 2^e with m in [sqrt(1/2), sqrt(2)[, then log(m) = 2 atanh((m-1) / (m+1))
+inline float fast_log(float x) {
+	const uint32_t sqrt_half = 0x3f3504f3;
+	const uint32_t shifted = float_bits(x) - sqrt_half;
+	const int32_t e = int32_t(shifted) >> 23;
+	const float m = bits_float((shifted & 0x7fffff) + sqrt_half);
+	
+	const float s = (m - 1) / (m + 1);
+	const float s2 = s * s;
+	const float log_m = s * (2.f + s2 * (2.f/3 + s2 * (2.f/5 + s2 * (2.f/7 + s2 * (2.f/9)))));
+	
+	const float r = float(e) * 0.693147181f + log_m;
+	return (x > 0) ? r : -std::numeric_limits<float>::infinity();
+}
+
+// Quadrant of a from the nearest multiple of pi/2, Cephes' polynomials on [-pi/4, pi/4]
+inline void fast_sincos(float a, float& sin_a, float& cos_a) {
+	const int32_t j = fast_floor(a * 0.636619772f + .5f);
+	const float r = float(a - j * 1.5707963267948966);
+	const float z = r * r;
+	
+	const float s = r + r * z * ((-1.9515295891e-4f * z + 8.3321608736e-3f) * z - 1.6666654611e-1f);
+	const float c = 1 - .5f * z + z * z * ((2.443315711809948e-5f * z - 1.388731625493765e-3f) * z + 4.166664568298827e-2f);
+	
+	// Quadrant swap and signs as bit masks: as selects they compile to branches
+	// that random angles mispredict
+	const uint32_t swap = 0u - uint32_t(j & 1);
+	const uint32_t s_bits = float_bits(s), c_bits = float_bits(c);
+	sin_a = bits_float(((s_bits & ~swap) | (c_bits & swap)) ^ (uint32_t(j & 2) << 30));
+	cos_a = bits_float(((c_bits & ~swap) | (s_bits & swap)) ^ (uint32_t((j + 1) & 2) << 30));
+}
+
+// Abramowitz & Stegun 4.4.46 on [0, 1], reflected for negative x
+inline float fast_acos(float x) {
+	const float ax = std::fabs(x);
+	const float p = ((((((-0.0012624911f * ax + 0.0066700901f) * ax - 0.0170881256f) * ax + 0.0308918810f) * ax
+		- 0.0501743046f) * ax + 0.0889789874f) * ax - 0.2145988016f) * ax + 1.5707963050f;
+	const float r = std::sqrt(std::fmax(1 - ax, 0.f)) * p;
+	return (x < 0) ? 3.14159265f - r : r;
+}
+
+// Abramowitz & Stegun 4.4.49 on [0, 1], the other octants by symmetry
+inline float fast_atan2(float y, float x) {
+	const float ax = std::fabs(x);
+	const float ay = std::fabs(y);
+	const float hi = std::fmax(ax, ay);
+	const float a = (hi > 0) ? std::fmin(ax, ay) / hi : 0.f;
+	
+	const float z = a * a;
+	const float p = (((((((0.0028662257f * z - 0.0161657367f) * z + 0.0429096138f) * z - 0.0752896400f) * z
+		+ 0.1065626393f) * z - 0.1420889944f) * z + 0.1999355085f) * z - 0.3333314528f) * z + 1;
+	
+	float r = a * p;
+	r = (ay > ax) ? 1.57079633f - r : r;
+	r = (x < 0) ? 3.14159265f - r : r;
+	return std::copysign(r, y);
+}
+
+
+inline void fast_log_batch(size_t n, const float* x, float* out) {
+	#pragma omp simd
+	for(size_t i = 0; i < n; i++)
+		out[i] = fast_log(x[i]);
+}
+
+inline void fast_sincos_batch(size_t n, const float* a, float* sin_a, float* cos_a) {
+	#pragma omp simd
+	for(size_t i = 0; i < n; i++)
+		fast_sincos(a[i], sin_a[i], cos_a[i]);
+}
+
+inline void fast_acos_batch(size_t n, const float* x, float* out) {
+	#pragma omp simd
+	for(size_t i = 0; i < n; i++)
+		out[i] = fast_acos(x[i]);
+}
+
+inline void fast_atan2_batch(size_t n, const float* y, const float* x, float* out) {
+	#pragma omp simd
+	for(size_t i = 0; i < n; i++)
+		out[i] = fast_atan2(y[i], x[i]);
+}
+
+#endif
\ No newline at end of file
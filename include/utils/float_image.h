@@ -0,0 +1,36 @@
+#ifndef FLOAT_IMAGE_H
+#define FLOAT_IMAGE_H
+
+#include <vector>
+#include <cstddef>
+
+// Planar float image
+// Each channel is one contiguous plane, row after row,
+// which keeps per-pixel passes friendly to SIMD
+class Float_Image {
+	public:
+		int width    = 0;
+		int height   = 0;
+		int channels = 0;
+		std::vector<float> data;
+		
+		Float_Image() {}
+		
+		Float_Image(int width, int height, int channels) {
+			resize(width, height, channels);
+		}
+		
+		void resize(int w, int h, int c) {
+			width = w;
+			height = h;
+			channels = c;
+			data.assign(size_t(w) * h * c, 0.f);
+		}
+		
+		size_t size() const {return size_t(width) * height;}
+		
+		float* plane(int c) {return data.data() + c * size();}
+		const float* plane(int c) const {return data.data() + c * size();}
+};
+
+#endif
\ No newline at end of file
@@ -4,6 +4,9 @@
 // P = Orig + t * Pos
 // t >= 0
 
+#include <cmath>
+#include <limits>
+
 #include "utils/vec3.h"
 
 class ray {
@@ -28,4 +31,26 @@ class ray {
 		}
 };
 
+// Ray in float for slab tests against float boxes
+// The origin is rounded down and up per axis: the near plane distance is
+// measured from the bound that shortens it, the far one from the bound that
+// lengthens it, so rounding the origin never moves a box away from the ray.
+struct Ray_Slabs {
+	float inv_dir[3];
+	float near_orig[3], far_orig[3];
+	
+	Ray_Slabs(const ray& r) {
+		for(int a = 0; a < 3; a++) {
+			const double o = r.origin()[a];
+			float lo = float(o), hi = lo;
+			if(lo > o) lo = std::nextafter(lo, -std::numeric_limits<float>::infinity());
+			if(hi < o) hi = std::nextafter(hi,	std::numeric_limits<float>::infinity());
+			
+			inv_dir[a] = 1. / r.direction()[a];
+			near_orig[a] = (inv_dir[a] < 0) ? lo : hi;
+			far_orig[a]  = (inv_dir[a] < 0) ? hi : lo;
+		}
+	}
+};
+
 #endif
\ No newline at end of file
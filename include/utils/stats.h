@@ -0,0 +1,58 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <cstdint>
+#include <iostream>
+
+#include "utils/float_image.h"
+
+// Traversal and shading counters of a frame
+// Only counted with STATS_MODE, the STAT macros compile to nothing otherwise
+struct frame_stats {
+	uint64_t rays		= 0;		// Every ray traced, camera and bounces
+	uint64_t paths		= 0;		// Camera rays
+	uint64_t bounces	= 0;		// Scattered rays
+	uint64_t nodes		= 0;		// BVH nodes visited
+	uint64_t aabb_tests = 0;
+	uint64_t prim_tests = 0;
+	
+	void merge(const frame_stats& o) {
+		rays		+= o.rays;
+		paths		+= o.paths;
+		bounces		+= o.bounces;
+		nodes		+= o.nodes;
+		aabb_tests	+= o.aabb_tests;
+		prim_tests	+= o.prim_tests;
+	}
+	
+	// Per-pixel cost used by the heatmap
+	uint64_t cost() const {return nodes + prim_tests;}
+	
+	void print(std::ostream& out) const {
+		double per_ray = rays ? 1. / rays : 0.;
+		out << "Rays: " << rays
+			<< " | bounces/path: " << (paths ? double(bounces) / paths : 0.)
+			<< " | nodes/ray: " << nodes * per_ray
+			<< " | AABB tests/ray: " << aabb_tests * per_ray
+			<< " | primitive tests/ray: " << prim_tests * per_ray << std::endl;
+	}
+};
+
+#ifdef STATS_MODE
+	// Counters of the calling thread, merged by the camera at the end of a frame
+	// Defined in utils.cpp
+	extern thread_local frame_stats thread_stats;
+	
+	#define STAT(counter)			(thread_stats.counter++)
+	#define STAT_ADD(counter, n)	(thread_stats.counter += (n))
+#else
+	#define STAT(counter)			((void)0)
+	#define STAT_ADD(counter, n)	((void)0)
+#endif
+
+// Writes plane 0 of 'cost' as a binary PPM, on a log scale
+// from black (cheapest) through blue and red to yellow (most expensive)
+// Defined in utils.cpp
+bool write_heatmap(const char* path, const Float_Image& cost);
+
+#endif
\ No newline at end of file
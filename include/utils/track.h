@@ -0,0 +1,49 @@
+#ifndef TRACK_H
+#define TRACK_H
+
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+// Keyframed value, linearly interpolated and held past both ends
+// T needs T + double * (T - T), like vec3 or double
+template<typename T>
+class Track {
+	private:
+		std::vector<std::pair<double, T>> keys;		// Sorted by time
+	
+	public:
+		Track() {}
+		
+		Track(const T& value) {
+			add(0, value);
+		}
+		
+		// Keeps the keys sorted, a key at the same time is replaced
+		Track& add(double time, const T& value) {
+			auto it = std::lower_bound(keys.begin(), keys.end(), time,
+				[](const std::pair<double, T>& key, double t) {return key.first < t;});
+			if(it != keys.end() && it->first == time)
+				it->second = value;
+			else
+				keys.insert(it, std::make_pair(time, value));
+			return *this;
+		}
+		
+		bool empty() const {return keys.empty();}
+		
+		T at(double time) const {
+			if(keys.empty()) return T();
+			if(time <= keys.front().first) return keys.front().second;
+			if(time >= keys.back().first) return keys.back().second;
+			
+			auto next = std::upper_bound(keys.begin(), keys.end(), time,
+				[](double t, const std::pair<double, T>& key) {return t < key.first;});
+			auto prev = next - 1;
+			
+			const double f = (time - prev->first) / (next->first - prev->first);
+			return prev->second + f * (next->second - prev->second);
+		}
+};
+
+#endif
\ No newline at end of file
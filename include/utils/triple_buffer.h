@@ -0,0 +1,42 @@
+#ifndef TRIPLE_BUFFER_H
+#define TRIPLE_BUFFER_H
+
+#include <atomic>
+
+// Single producer, single consumer exchange of whole frames
+// The writer fills its back slot and publishes it, the reader takes the
+// latest published slot; neither ever waits for the other, and frames
+// published in between are simply skipped.
+template<typename T>
+class Triple_Buffer {
+	private:
+		static constexpr int fresh = 4;		// Set on 'middle' by publish(), cleared by acquire()
+		static constexpr int index = 3;
+		
+		T slots[3];
+		int back  = 0;						// Writer side
+		int front = 1;						// Reader side
+		std::atomic<int> middle{2};
+	
+	public:
+		T& write_buffer() {return slots[back];}
+		
+		// Hands the back slot over and takes a free one
+		void publish() {
+			back = middle.exchange(back | fresh) & index;
+		}
+		
+		// True, with read_buffer() updated, if a frame was published since the last call
+		bool acquire() {
+			if(!(middle.load() & fresh)) return false;
+			front = middle.exchange(front) & index;
+			return true;
+		}
+		
+		const T& read_buffer() const {return slots[front];}
+		
+		// Setup only, before both sides start
+		T& slot(int i) {return slots[i];}
+};
+
+#endif
\ No newline at end of file
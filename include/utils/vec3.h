@@ -98,6 +98,11 @@ inline vec3 operator/(const vec3& v, double a) {
 	return (1/a) * v;
 }
 
+// Per component
+inline vec3 abs(const vec3& v) {
+	return vec3(std::fabs(v.e[0]), std::fabs(v.e[1]), std::fabs(v.e[2]));
+}
+
 inline double dot(const vec3& u, const vec3& v){
 	return (u.e[0]*v.e[0]) + (u.e[1]*v.e[1]) + (u.e[2]*v.e[2]);
 }
@@ -116,7 +121,9 @@ inline vec3 random_unit_vector() {
 	float z = get_rand_double(-1, 1);
     float a = get_rand_double(0, TWO_PI);
     float r = sqrtf(1 - z*z);
-    return vec3(r * cosf(a), r * sinf(a), z);
+    float s, c;
+    fast_sincos(a, s, c);
+    return vec3(r * c, r * s, z);
 }
 
 inline vec3 random_unit_hemisphere(const vec3& normal) {
@@ -127,7 +134,9 @@ inline vec3 random_unit_hemisphere(const vec3& normal) {
 inline vec3 random_unit_disk() {
 	float r = get_rand_double(-1, 1);
 	float a = get_rand_double(0, TWO_PI);
-	return vec3(r * cosf(a), r * sinf(a), 0);
+	float s, c;
+	fast_sincos(a, s, c);
+	return vec3(r * c, r * s, 0);
 }
 
 inline vec3 reflect(const vec3& v, const vec3& n) {
@@ -1,7 +1,11 @@
 #include <cerrno>
+#include <chrono>
 #include <iostream>
 #include <algorithm>
 #include <cmath>
+#include <cstring>
+#include <mutex>
+#include <thread>
 
 #include <SDL2/SDL.h>
 
@@ -14,11 +18,22 @@ using namespace std;
 #include "defs.h"
 //#include "bvh.h"
 #include "lbvh.h"
+#include "qbvh.h"
+#include "mbvh.h"
+#include "sbvh.h"
 #include "camera.h"
+#include "frame_budget.h"
+#include "scene_cache.h"
+#include "scenes.h"
+#include "render_farm.h"
+#include "frame_writer.h"
+#include "utils/triple_buffer.h"
 
 // Scene parameters
 hittable_list scene;
+hittable_list scene_objects;		// Before the BVH, as described to render workers
 Camera cam;
+Frame_Budget budget;
 
 // SDL-specific
 // #if is used for region
@@ -28,7 +43,29 @@ SDL_Renderer* 	g_renderer;
 SDL_Texture*	g_texture;
 SDL_Event 		g_event;
 
-bool is_running;
+std::atomic<bool> is_running(false);
+
+// Finished frame, at the resolution it was rendered at
+struct Frame {
+	std::vector<uint32_t> pixels;
+	int width  = WIDTH;
+	int height = HEIGHT;
+};
+
+// Render thread, owns 'cam' and 'budget' while running
+static std::thread render_thread;
+static Triple_Buffer<Frame> frames;
+
+// Pose requested by the input handler, picked up before each frame
+static std::mutex pose_mutex;
+static Camera_Pose pending_pose;
+static bool pose_changed = false;
+
+// Latest requested pose, main thread side
+static Camera_Pose input_pose;
+
+// Set by the P key, the render thread reports on the next frame
+static std::atomic<bool> report_requested(false);
 
 
 void init_SDL(void){
@@ -38,6 +75,8 @@ void init_SDL(void){
 	}
 	
 	SDL_SetHint(SDL_HINT_RENDER_DRIVER, "gpu");
+	// Frames below the window resolution are upscaled bilinearly
+	SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, "linear");
 	
 	g_window = SDL_CreateWindow(
 		"Raytracing",
@@ -89,316 +128,365 @@ void close_SDL(void){
 		// O/U: Rise/Lower
 		// I/K: Forward/Backward
 		// L/J: Right/Left
+	
+	// P: Print the frame timings (and stats, heatmap.ppm with stats=1)
+	// Escape: Quit
 
 void handle_INPUT(void){
+	bool moved = false;
+	const float speed = cam.speed;
+	
 	while(SDL_PollEvent(&g_event)){
 		if(g_event.type == SDL_QUIT) is_running = false;
 		
 		if(g_event.type == SDL_KEYDOWN){
 			// cout << "Key down:" << SDL_GetKeyName(g_event.key.keysym.sym) << endl;
 			// cout.flush();
+			moved = true;
 			switch(g_event.key.keysym.sym) {
 				case SDLK_z:
-					cam.forward();
+					input_pose.forward(speed);
 					break;
 				case SDLK_e:
-					cam.rise();
+					input_pose.rise(speed);
 					break;
 				case SDLK_d:
-					cam.right();
+					input_pose.right(speed);
 					break;
 				case SDLK_s:
-					cam.speed *= -1;
-					cam.forward();
-					cam.speed *= -1;
+					input_pose.forward(-speed);
 					break;
 				case SDLK_q:
-					cam.speed *= -1;
-					cam.right();
-					cam.speed *= -1;
+					input_pose.right(-speed);
 					break;
 				case SDLK_a:
-					cam.speed *= -1;
-					cam.rise();
-					cam.speed *= -1;
+					input_pose.rise(-speed);
 					break;
 					
 				case SDLK_i:
-					cam.foc_forward();
+					input_pose.foc_forward(speed);
 					break;
 				case SDLK_o:
-					cam.foc_rise();
+					input_pose.foc_rise(speed);
 					break;
 				case SDLK_l:
-					cam.foc_right();
+					input_pose.foc_right(speed);
 					break;
 				case SDLK_k:
-					cam.speed *= -1;
-					cam.foc_forward();
-					cam.speed *= -1;
+					input_pose.foc_forward(-speed);
 					break;
 				case SDLK_j:
-					cam.speed *= -1;
-					cam.foc_right();
-					cam.speed *= -1;
+					input_pose.foc_right(-speed);
 					break;
 				case SDLK_u:
-					cam.speed *= -1;
-					cam.foc_rise();
-					cam.speed *= -1;
+					input_pose.foc_rise(-speed);
+					break;
+				
+				case SDLK_p:
+					report_requested = true;
+					moved = false;
+					break;
+				case SDLK_ESCAPE:
+					is_running = false;
 					break;
 				default:
+					moved = false;
 					break;
 			}
 		}
 	}
+	
+	if(moved) {
+		std::lock_guard<std::mutex> lock(pose_mutex);
+		pending_pose = input_pose;
+		pose_changed = true;
+	}
+}
+
+
+// Printed on request and once at exit, not every frame
+static void report_FRAME(void){
+	if(cam.denoise)
+		cout << "Denoise: " << cam.denoiser.last_ms << " ms" << endl;
+	
+	#ifdef STATS_MODE
+		cam.stats.print(cout);
+		write_heatmap("heatmap.ppm", cam.cost_buffer);
+	#endif
 }
 
+static void render_LOOP(void){
+	bool rendered = false;
+	while(is_running){
+		bool moved = false;
+		{
+			std::lock_guard<std::mutex> lock(pose_mutex);
+			if(pose_changed) {
+				cam.set_pose(pending_pose);
+				pose_changed = false;
+				moved = true;
+			}
+		}
+		
+		const Frame_Settings settings = budget.next(moved);
+		
+		// Converged, nothing left to refine
+		if(settings.refine && cam.accumulated_frames() >= budget.max_refine) {
+			this_thread::sleep_for(chrono::milliseconds(10));
+			continue;
+		}
+		
+		cam.max_bounces = settings.bounces;
+		#ifdef SAMPLING_MODE
+			cam.samples_per_pixel = settings.samples;
+		#endif
+		cam.refine = settings.refine;
+		cam.set_resolution(max(1, int(WIDTH * settings.scale)), max(1, int(HEIGHT * settings.scale)));
+		
+		auto start_time = chrono::steady_clock::now();
+		cam.compute_FRAME();
+		rendered = true;
+		budget.record(chrono::duration<double, milli>(chrono::steady_clock::now() - start_time).count());
+		// cam.ascend();
+		
+		if(report_requested.exchange(false))
+			report_FRAME();
+		
+		// Every pixel is rewritten each frame, so the finished buffer
+		// is swapped out rather than copied
+		Frame& frame = frames.write_buffer();
+		frame.pixels.swap(cam.display_buffer);
+		frame.width  = cam.width();
+		frame.height = cam.height();
+		frames.publish();
+	}
+	
+	if(rendered) report_FRAME();
+}
 
-void update_RENDER(void){
+void start_RENDER(void){
+	for(int i = 0; i < 3; i++)
+		frames.slot(i).pixels.assign(WIN_SIZE, 0xFFU << 24);
 	
-	cam.compute_FRAME();
-	// cam.ascend();
+	input_pose = pending_pose = cam.pose();
 	cam.refocus();
 	
+	render_thread = std::thread(render_LOOP);
+}
+
+// Waits for the frame in progress
+void stop_RENDER(void){
+	is_running = false;
+	if(render_thread.joinable())
+		render_thread.join();
+}
+
+
+void present_FRAME(void){
 	// Optimized approach
 	// using Lock/Unlock texture on GPU
 	
-	void* texture_pixels;
-	int pitch;
-	
-	SDL_LockTexture(g_texture, NULL, &texture_pixels, &pitch);
+	// Part of the texture holding the last frame
+	static SDL_Rect shown = {0, 0, WIDTH, HEIGHT};
 	
-	// Per pixel (32-bit) manipulation
-	// ARGB8888 format	
-	memcpy(texture_pixels, cam.display_buffer.data(), cam.display_buffer_size);
-	
-	SDL_UnlockTexture(g_texture);
+	if(frames.acquire()) {
+		const Frame& frame = frames.read_buffer();
+		shown.w = frame.width;
+		shown.h = frame.height;
+		
+		void* texture_pixels;
+		int pitch;
+		
+		SDL_LockTexture(g_texture, &shown, &texture_pixels, &pitch);
+		
+		// Per pixel (32-bit) manipulation
+		// ARGB8888 format, row by row as the texture keeps its full pitch
+		for(int y = 0; y < frame.height; y++)
+			memcpy(static_cast<uint8_t*>(texture_pixels) + size_t(y) * pitch,
+				frame.pixels.data() + size_t(y) * frame.width, sizeof(uint32_t) * frame.width);
+		
+		SDL_UnlockTexture(g_texture);
+	}
 	
 	SDL_RenderClear(g_renderer);
 	
-	SDL_RenderCopy(g_renderer, g_texture, NULL, NULL);
+	// Upscaled to the window
+	SDL_RenderCopy(g_renderer, g_texture, &shown, NULL);
 	SDL_RenderPresent(g_renderer);
 }
 #endif
 
-void scene_origScene(void) {
-	
-	auto checker = make_shared<Checker_Texture>(.3, color(.1), color(.9));
-	
-	auto mat_center = make_shared<Metal>(color(.3), 0);
-	auto mat_ground = make_shared<Lambertian>(checker);
-	auto mat_sphsky = make_shared<Metal>(color(.9, .3, .3), .3);
-	auto mat_spher1 = make_shared<Metal>(color(.7, .6, .2), .7);
-	auto mat_spher2 = make_shared<Lambertian>(color(.2, .6, .7));
-	auto mat_spher3 = make_shared<Dielectric>(1./1.33);
-	auto mat_spher4 = make_shared<Dielectric>(2.5);
-	
-	
-	scene.add(make_shared<Sphere>(point3(0,0,-.5),	.25, mat_center));
-	scene.add(make_shared<Sphere>(point3(10,10,-20), 10, mat_sphsky));
-	scene.add(make_shared<Sphere>(point3(0,-30.5,-1),30, mat_ground));
-	scene.add(make_shared<Sphere>(point3(-10,5,-10),  3, mat_spher1));
-	scene.add(make_shared<Sphere>(point3(-10,5,-2), point3(-10,2,-2), 5, mat_spher2));
-	scene.add(make_shared<Sphere>(point3(-10,2,-10),  4, mat_spher3));
-	scene.add(make_shared<Sphere>(point3(5,2,-10),    4, mat_spher4));
-}
-
-void scene_bookScene(void) {
-	// Scene from Raytracing in One Weekend
-	
-	auto ground_material = make_shared<Lambertian>(color(0.5, 0.5, 0.5));
-    scene.add(make_shared<Sphere>(point3(0,-1000,0), 1000, ground_material));
-
-    for (int a = -5; a < 5; a++) {
-        for (int b = -5; b < 5; b++) {
-            auto choose_mat = get_rand_double();
-            point3 center(a + 0.9*get_rand_double(), 0.2, b + 0.9*get_rand_double());
-
-            if ((center - point3(4, 0.2, 0)).len() > 0.9) {
-                shared_ptr<IMaterial> sphere_material;
-
-                if (choose_mat < 0.8) {
-                    // Diffuse
-                    auto albedo = color::random() * color::random();
-                    sphere_material = make_shared<Lambertian>(albedo);
-					auto center2 = center + vec3(0,get_rand_double(0, 1),0);
-                    scene.add(make_shared<Sphere>(center, center2, 0.2, sphere_material));
-                } else if (choose_mat < 0.95) {
-                    // Metal
-                    auto albedo = color::random(0.5, 1);
-                    auto fuzz = get_rand_double(0, 0.5);
-                    sphere_material = make_shared<Metal>(albedo, fuzz);
-                    scene.add(make_shared<Sphere>(center, 0.2, sphere_material));
-                } else {
-                    // Glass
-                    sphere_material = make_shared<Dielectric>(1.5);
-                    scene.add(make_shared<Sphere>(center, 0.2, sphere_material));
-                }
-            }
-        }
-    }
-
-    auto material1 = make_shared<Dielectric>(1.5);
-    scene.add(make_shared<Sphere>(point3(0, 1, 0), 1.0, material1));
-
-    auto material2 = make_shared<Lambertian>(color(0.4, 0.2, 0.1));
-    scene.add(make_shared<Sphere>(point3(-4, 1, 0), 1.0, material2));
-
-    auto material3 = make_shared<Metal>(color(0.7, 0.6, 0.5), 0.0);
-    scene.add(make_shared<Sphere>(point3(4, 1, 0), 1.0, material3));
-	
-	
-}
+const char* scene_cache_path = nullptr;
 
-void scene_earthScene(void) {
-	
-    auto earth_texture = make_shared<IMG_Texture>("1024px-Nasa_land_ocean_ice_8192.jpg");
-    auto earth_surface = make_shared<Lambertian>(earth_texture);
-    auto globe = make_shared<Sphere>(point3(0,2,0), 2, earth_surface);
+void setup_SCENE(void){
+	float dim = 5;
 	
-	auto checker = make_shared<Checker_Texture>(.3, color(.1), color(.9));
-	auto mat_ground = make_shared<Lambertian>(checker);
-	auto ground = make_shared<Sphere>(point3(0,-30.5,-1),30, mat_ground);
+	// Names what is built below and how, so a cached scene is only reused
+	// for the same scene and tree; the key also covers the executable,
+	// so a rebuilt program with an edited scene function misses the cache
+	const uint64_t recipe = Scene_Cache::recipe_key("cornell " + to_string(dim));
+	const uint32_t build = Scene_Cache::build_config(BUILDER_SBVH, ORDER_VAN_EMDE_BOAS);
+	
+	shared_ptr<LBVH> bvh;
+	if(scene_cache_path)
+		bvh = Scene_Cache::load_scene(scene_cache_path, recipe, build, scene);
+	
+	if(!bvh) {
+		scene_cornellScene(scene, dim);
+		// scene_earthScene(scene);
+		// scene_meshScene(scene, "models/bunny.obj");
+		// scene_instanceScene(scene);
+		// scene_smokeScene(scene, dim);
+		// scene_generatedScene(scene, generator_params());
+		
+		// Spatial splits keep the large walls out of most nodes
+		bvh = SBVH::build(scene);
+		// bvh = make_shared<LBVH>(scene);
+		// Saved in this order, so cached trees load already laid out
+		bvh->reorder(ORDER_VAN_EMDE_BOAS);
+		if(scene_cache_path) Scene_Cache::save(scene_cache_path, scene, *bvh, build, recipe);
+	}
+	scene_objects = scene;
 	
-	auto mat_sphsky = make_shared<Dielectric>(2.5);
-	auto glass = make_shared<Sphere>(point3(5,5,-20), 10, mat_sphsky);
+	// On stderr, stdout may carry rendered frames
+	#ifdef STATS_MODE
+		bvh->report().print(cerr);
+	#endif
+	scene = hittable_list(bvh);
+	// Compressed nodes, 16 bytes (8-bit planes) or 32 bytes (16-bit planes)
+	// scene = hittable_list(make_shared<QBVH8>(*bvh));
+	// Moving spheres tested at the time of each ray (scene_bookScene)
+	// scene = hittable_list(make_shared<MBVH>(*bvh));
+	// scene = hittable_list(make_shared<BVH_node>(scene));
 	
-	auto mat_marble = make_shared<Lambertian>(color(.2, .6, .7));
-	auto marble = make_shared<Sphere>(point3(-15, 5, -10), 5, mat_marble);
+	cam = Camera(scene);
 	
-	auto mat_metal = make_shared<Metal>(color(.7, .6, .2), .7);
-	auto metal_ball = make_shared<Sphere>(point3(-20, 3,-7),  4, mat_metal);
 	
-	auto mat_light = make_shared<Emitter>(color(10));
-	auto light_ball = make_shared<Sphere>(point3(3,1,1), .5, mat_light);
+	cam.eye_point = point3(0,dim/2,dim);
+	cam.foc_point = point3(0,dim/2,-dim);
+	// cam.eye_point = point3(3,2,5);
+	// cam.foc_point = point3(0);
 	
-	// auto lollipop = make_shared<Lollipop_Texture>(10, color(0), color(90, .1, .4));
-	// auto mat_lollipop = make_shared<Emitter>(lollipop);
-	// auto sph_lolli = make_shared<Sphere>(point3(-5,2,0), 1.5, mat_lollipop);
+	cam.speed = 0.1;
 	
-	auto sph_gas_shape = make_shared<Sphere>(point3(-5,2,0), 1.5,make_shared<Lambertian>(color(1)));
+	setup_CAMERA(cam);
+	cam.init_CAMERA(WIDTH, HEIGHT);
 	
-	auto sph_gas = make_shared<Constant_Medium>(sph_gas_shape, 0.5, color(1));
+	// Moving frames are kept within 50 ms, trading bounces, samples
+	// then resolution; still frames refine up to full quality
+	#ifdef SAMPLING_MODE
+		budget = Frame_Budget(50, cam.max_bounces, cam.samples_per_pixel);
+	#else
+		budget = Frame_Budget(50, cam.max_bounces, 1);
+	#endif
 	
-	auto lollipop2 = make_shared<Lollipop_Texture>(15, color(.4,90,.1), color(.2,.1,90));
-	auto mat_lollipop2 = make_shared<Emitter>(lollipop2);
-	auto pla_lolli = make_shared<Quad>(point3(-5,-2,3),vec3(0,3,0),vec3(3,0,3),mat_lollipop2);
+	// Frames reuse the previous ones, reprojected through their first hits
+	cam.temporal = true;
 	
 	
-	scene.add(globe);
-	scene.add(ground);
-	scene.add(glass);
-	scene.add(marble);
-	scene.add(metal_ball);
-	scene.add(light_ball);
-	scene.add(sph_gas);
-	// scene.add(sph_lolli);
-	scene.add(pla_lolli);
-}
-
-void scene_cornellScene(float dim) {
-	
-	auto green_mat = make_shared<Lambertian>(color(0, 1, 0));
-	auto red_mat   = make_shared<Lambertian>(color(1, 0, 0));
-	auto blue_mat  = make_shared<Lambertian>(color(0, 0, 1));
-	auto white_mat = make_shared<Lambertian>(color(1));
-	auto emit_mat  = make_shared<Emitter>(color(10));
-	// auto glass_mat = make_shared<Dielectric>(2);
-	auto metal_mat = make_shared<Metal>(color(.5), 0);
-	
-	
-	auto earth_texture = make_shared<IMG_Texture>("1024px-Nasa_land_ocean_ice_8192.jpg");
-    auto earth_surface = make_shared<Lambertian>(earth_texture);
-	
-	auto left_wall = make_shared<Quad>(
-		point3(-dim/2.,0,0),
-		vec3(0,dim,0),
-		vec3(0,0,dim),
-	red_mat);
-	
-	auto right_wall = make_shared<Quad>(
-		point3(dim/2.,0,0),
-		vec3(0,dim,0),
-		vec3(0,0,dim),
-	green_mat);
-	
-	auto back_wall = make_shared<Quad>(
-		point3(-dim/2.,0,0),
-		vec3(0,dim,0),
-		vec3(dim,0,0),
-	blue_mat);
-	
-	auto ground = make_shared<Quad>(
-		point3(-dim/2.,0,0),
-		vec3(0,0,dim),
-		vec3(dim,0,0),
-	white_mat);
-	
-	auto ceiling = make_shared<Quad>(
-		point3(-dim/2.,dim,0),
-		vec3(0,0,dim),
-		vec3(dim,0,0),
-	white_mat);
-	
-	auto light_panel = make_shared<Quad>(
-		point3(-dim/2.+dim/3,dim-dim/100,dim/3),
-		vec3(0,0,dim/3),
-		vec3(dim/3,0,0),
-	emit_mat);
-	
-	auto globe = make_shared<Sphere>(point3(0,dim/2,0), dim/3, earth_surface);
-	// auto glass = make_shared<Sphere>(point3(-dim/4,dim/2-dim/4,dim/3), dim/5, glass_mat);
-	auto metal = make_shared<Sphere>(point3(dim/4,dim/2-dim/4,dim/3), dim/5, metal_mat);
-	
-	auto sph_gas_shape = make_shared<Sphere>(point3(-dim/4,dim/2-dim/4,dim/3), dim/5,make_shared<Lambertian>(color(0.7)));
-	
-	auto sph_gas = make_shared<Constant_Medium>(sph_gas_shape, 0.5, color(0.7));
-	
-	scene.add(left_wall);
-	scene.add(right_wall);
-	scene.add(back_wall);
-	scene.add(ground);
-	scene.add(ceiling);
-	scene.add(light_panel);
-	scene.add(globe);
-	// scene.add(glass);
-	scene.add(sph_gas);
-	scene.add(metal);
+	return;
 }
 
-void setup_SCENE(void){
-	float dim = 5;
-	scene_cornellScene(dim);
-	// scene_earthScene();
+void setup_CAMERA(Camera& c){
+	c.camera_up = vec3(0,1,0);
 	
-	scene = hittable_list(make_shared<LBVH>(scene));
-	// scene = hittable_list(make_shared<BVH_node>(scene));
+	c.FOV = 100;
 	
-	cam = Camera(scene);
+	c.background = color(0);
+	// c.background = color(.1, 0.08, 0.07);
+	// c.background = .2*color(0.53, 0.806, 1.2);
 	
+	#ifdef SAMPLING_MODE
+		c.samples_per_pixel = 50;
+	#endif
+	c.max_bounces = 50;
 	
-	cam.eye_point = point3(0,dim/2,dim);
-	cam.foc_point = point3(0,dim/2,-dim);
-	// cam.eye_point = point3(3,2,5);
-	// cam.foc_point = point3(0);
-	cam.camera_up = vec3(0,1,0);
+	// Edge-aware A-Trous filter over the first-hit AOVs,
+	// meant for low sample counts
+	c.denoise = false;
 	
-	cam.FOV = 100;
+	// Display transform, clamped at exposure 0 by default
+	// c.resolver.tonemap = TONEMAP_ACES;
+	// c.resolver.exposure = 1;
+}
+
+bool farm_RENDER(int workers, const char* path){
+	Scene_Writer w = Scene_Cache::describe(scene_objects);
+	if(!w.complete) {
+		cerr << "Render farm: some objects cannot be serialized" << endl;
+		return false;
+	}
 	
-	cam.speed = 0.1;
+	Render_Job job = {};
+	write_vec3(job.eye, cam.eye_point);
+	write_vec3(job.focus, cam.foc_point);
+	write_vec3(job.up, cam.camera_up);
+	write_vec3(job.background, cam.background);
+	job.fov = cam.FOV;
+	job.width = WIDTH;
+	job.height = HEIGHT;
+	job.max_bounces = cam.max_bounces;
+	#ifdef SAMPLING_MODE
+		job.samples = cam.samples_per_pixel;
+	#endif
+	job.seed = 1;
 	
-	cam.background = color(0);
-	// cam.background = color(.1, 0.08, 0.07);
-	// cam.background = .2*color(0.53, 0.806, 1.2);
+	auto start_time = chrono::steady_clock::now();
 	
+	Render_Farm farm("/proc/self/exe", workers, w);
+	Float_Image frame;
+	if(!farm.render(frame, job)) return false;
 	
-	cam.init_CAMERA(WIDTH, HEIGHT);
-	#ifdef SAMPLING_MODE
-		cam.samples_per_pixel = 50;
-	#endif
-	cam.max_bounces = 50;
+	auto end_time = chrono::steady_clock::now();
+	cout << "Rendered on " << farm.alive() << " workers in "
+		 << chrono::duration<double>(end_time - start_time).count() << " s" << endl;
 	
+	vector<uint32_t> pixels(frame.size());
+	cam.resolver.run(frame, pixels.data());
+	return write_ppm(path, pixels.data(), frame.width, frame.height);
+}
+
+bool sequence_RENDER(int first, int last, const char* output){
+	hittable_list objects;
+	Animation anim;
+	scene_animatedScene(objects, anim, 5);
+	
+	// Only a few objects move, refitting keeps the trees between frames
+	// Node bounds follow the objects over the shutter, one tree per shutter segment
+	auto bvh = make_shared<MBVH>(objects.objects);
+	
+	Camera seq = Camera(hittable_list(bvh));
+	setup_CAMERA(seq);
+	seq.init_CAMERA(WIDTH, HEIGHT);
+	
+	if(last < first) last = int(anim.duration * anim.fps);
+	
+	// Progress goes to stderr, stdout may carry the frames
+	Frame_Writer writer(output, WIDTH, HEIGHT, anim.fps);
+	auto start_time = chrono::steady_clock::now();
+	
+	for(int f = first; f <= last; f++) {
+		const double open  = f / anim.fps;
+		const double close = (f + anim.shutter) / anim.fps;
+		for(auto& object : anim.objects)
+			object->set_shutter(open, close);
+		bvh->refit();
+		
+		// Posed mid-shutter
+		seq.eye_point = anim.eye.at((open + close) / 2);
+		seq.foc_point = anim.focus.at((open + close) / 2);
+		seq.refocus();
+		
+		seq.compute_FRAME();
+		
+		// The camera allocates a new buffer for the next frame
+		if(!writer.push(f, std::move(seq.display_buffer))) return false;
+		cerr << "Frame " << f << " / " << last << "\r" << flush;
+	}
 	
-	return;
+	const bool ok = writer.finish();
+	auto end_time = chrono::steady_clock::now();
+	cerr << endl << last - first + 1 << " frames in "
+		 << chrono::duration<double>(end_time - start_time).count() << " s" << endl;
+	return ok;
 }
@@ -0,0 +1,135 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "frame_writer.h"
+#include "utils.h"
+
+static bool ends_with(const std::string& s, const char* suffix) {
+	const size_t n = strlen(suffix);
+	return s.size() >= n && s.compare(s.size() - n, n, suffix) == 0;
+}
+
+// The pattern is handed to snprintf with a single int: it may only hold
+// one %d or %i conversion, with flags and a width, besides %% escapes
+static bool valid_frame_pattern(const std::string& pattern) {
+	int conversions = 0;
+	for(size_t i = 0; i < pattern.size(); i++) {
+		if(pattern[i] != '%') continue;
+		if(++i < pattern.size() && pattern[i] == '%') continue;
+		
+		while(i < pattern.size() && strchr("0-+ ", pattern[i])) i++;
+		while(i < pattern.size() && pattern[i] >= '0' && pattern[i] <= '9') i++;
+		if(i == pattern.size() || (pattern[i] != 'd' && pattern[i] != 'i')) return false;
+		conversions++;
+	}
+	return conversions == 1;
+}
+
+Frame_Writer::Frame_Writer(const std::string& output, int width, int height, double fps, size_t queue_depth)
+: output(output), width(width), height(height), fps(fps), queue_depth(std::max<size_t>(queue_depth, 1)) {
+	if(output == "-" || ends_with(output, ".y4m")) {
+		stream = (output == "-") ? stdout : fopen(output.c_str(), "wb");
+		if(!stream) {
+			perror("Could not open frame stream");
+			failed = true;
+		} else {
+			// 4:4:4, so chroma is not subsampled; frame rate as a ratio
+			const long rate = std::lround(fps * 1000);
+			if(rate % 1000 == 0)
+				fprintf(stream, "YUV4MPEG2 W%d H%d F%ld:1 Ip A1:1 C444\n", width, height, rate / 1000);
+			else
+				fprintf(stream, "YUV4MPEG2 W%d H%d F%ld:1000 Ip A1:1 C444\n", width, height, rate);
+		}
+	} else if(!valid_frame_pattern(output)) {
+		fprintf(stderr, "Frame pattern '%s' needs exactly one integer conversion, e.g. frame_%%04d.ppm\n", output.c_str());
+		failed = true;
+	}
+	
+	worker = std::thread(&Frame_Writer::run, this);
+}
+
+Frame_Writer::~Frame_Writer() {
+	finish();
+	
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		closing = true;
+	}
+	changed.notify_all();
+	worker.join();
+	
+	if(stream && stream != stdout) fclose(stream);
+	else if(stream) fflush(stream);
+}
+
+bool Frame_Writer::push(int index, std::vector<uint32_t>&& pixels) {
+	std::unique_lock<std::mutex> guard(lock);
+	changed.wait(guard, [this] {return queue.size() < queue_depth || failed;});
+	if(failed) return false;
+	
+	queue.push_back({index, std::move(pixels)});
+	guard.unlock();
+	changed.notify_all();
+	return true;
+}
+
+bool Frame_Writer::finish() {
+	std::unique_lock<std::mutex> guard(lock);
+	changed.wait(guard, [this] {return queue.empty() || failed;});
+	return !failed;
+}
+
+void Frame_Writer::run() {
+	std::unique_lock<std::mutex> guard(lock);
+	while(true) {
+		changed.wait(guard, [this] {return !queue.empty() || closing;});
+		if(queue.empty()) return;
+		
+		// The frame stays queued while written, so finish() waits for it
+		// Pushing to a deque does not move its elements
+		const Pending& frame = queue.front();
+		const bool skip = failed;
+		guard.unlock();
+		const bool ok = skip || write(frame);
+		guard.lock();
+		
+		if(!ok) failed = true;
+		queue.pop_front();
+		changed.notify_all();
+	}
+}
+
+bool Frame_Writer::write(const Pending& frame) {
+	if(stream) return write_y4m(frame.pixels);
+	
+	char path[4096];
+	snprintf(path, sizeof(path), output.c_str(), frame.index);
+	return write_ppm(path, frame.pixels.data(), width, height);
+}
+
+// BT.601, limited range, as players assume for Y4M
+bool Frame_Writer::write_y4m(const std::vector<uint32_t>& pixels) {
+	const size_t N = size_t(width) * height;
+	planes.resize(3 * N);
+	uint8_t* Y  = planes.data();
+	uint8_t* Cb = Y + N;
+	uint8_t* Cr = Cb + N;
+	
+	for(size_t i = 0; i < N; i++) {
+		const int r = (pixels[i] >> 16) & 0xFF;
+		const int g = (pixels[i] >> 8) & 0xFF;
+		const int b =  pixels[i] & 0xFF;
+		
+		// 8-bit fixed point, rounded
+		Y[i]  = uint8_t(( 66 * r + 129 * g +  25 * b + 128 + (16  << 8)) >> 8);
+		Cb[i] = uint8_t((-38 * r -  74 * g + 112 * b + 128 + (128 << 8)) >> 8);
+		Cr[i] = uint8_t((112 * r -  94 * g -  18 * b + 128 + (128 << 8)) >> 8);
+	}
+	
+	if(fputs("FRAME\n", stream) < 0 || fwrite(planes.data(), 1, planes.size(), stream) != planes.size()) {
+		perror("Could not write frame");
+		return false;
+	}
+	return true;
+}
\ No newline at end of file
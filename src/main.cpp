@@ -1,10 +1,13 @@
 #define SDL_MAIN_HANDLED // Fixes 99.9% of bugs
 
 #include <chrono>
+#include <cstdlib>
+#include <cstring>
 #include <thread>
 #include <iostream>
 
 #include "display.h"
+#include "render_farm.h"
 
 using namespace std;
 using namespace std::chrono;
@@ -12,10 +15,33 @@ using namespace std::chrono;
 const int FRAMERATE = 30;
 constexpr int FRAME_DELAY_MS = 1e3/FRAMERATE;
 
-extern bool is_running;
 
 
 int main(int argc, char** argv){
+	// --cache path [mode]: keeps the scene and its BVH in 'path' across runs
+	if(argc > 2 && !strcmp(argv[1], "--cache")) {
+		scene_cache_path = argv[2];
+		argc -= 2;
+		argv += 2;
+	}
+	
+	// Started by a render farm coordinator
+	if(argc > 2 && !strcmp(argv[1], "--worker"))
+		return farm_worker(atoi(argv[2]));
+	
+	// Final frame over local worker processes, no window
+	// --farm [workers] [output.ppm]
+	if(argc > 1 && !strcmp(argv[1], "--farm")) {
+		setup_SCENE();
+		int workers = (argc > 2) ? atoi(argv[2]) : int(thread::hardware_concurrency());
+		return farm_RENDER(max(workers, 1), (argc > 3) ? argv[3] : "render.ppm") ? 0 : 1;
+	}
+	
+	// Animation frames, streamed to numbered images or a Y4M pipe, no window
+	// --sequence first last [frame_%04d.ppm | out.y4m | -], last < first for the whole animation
+	if(argc > 3 && !strcmp(argv[1], "--sequence"))
+		return sequence_RENDER(atoi(argv[2]), atoi(argv[3]), (argc > 4) ? argv[4] : "frame_%04d.ppm") ? 0 : 1;
+	
 	init_SDL();
 	
 	setup_SCENE();
@@ -23,25 +49,18 @@ int main(int argc, char** argv){
 	getchar();
 	
 	is_running = true;
+	start_RENDER();
 	
+	// Input and presentation never wait for a frame to finish
 	while(is_running){
-		// auto start_time = high_resolution_clock::now();
+		handle_INPUT();
 		
-		// handle_INPUT();
+		present_FRAME();
 		
-		update_RENDER();
-		
-		// auto end_time	= high_resolution_clock::now();
-
-		// auto delta_time = duration_cast<microseconds>(end_time - start_time);
-		
-		// cout << "FPS: " << 1e6/delta_time.count() << endl;
-		
-		// this_thread::sleep_for(chrono::milliseconds(FRAME_DELAY_MS));
-		is_running = false;
+		this_thread::sleep_for(chrono::milliseconds(FRAME_DELAY_MS));
 	}
 	
-	getchar();
+	stop_RENDER();
 	
 	close_SDL();
 }
\ No newline at end of file
@@ -0,0 +1,324 @@
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <vector>
+#include <omp.h>
+
+#include "defs.h"
+
+// Streaming Wavefront OBJ reader
+// The file is read in large blocks cut at line ends. Each block is split
+// into one slice per task: a first parallel pass counts the elements of
+// every slice, prefix sums turn the counts into output offsets, and a
+// second parallel pass parses straight into the final flat buffers.
+// Only 'v', 'vt', 'vn' and 'f' lines are read, polygons become fans.
+
+namespace {
+
+const size_t block_size = size_t(64) << 20;
+
+struct Slice {
+	const char* begin;
+	const char* end;
+	size_t v, vt, vn, tris;	// Element counts, then output offsets
+	bool bad;
+};
+
+inline bool is_space(char c) {return c == ' ' || c == '\t' || c == '\r';}
+
+inline const char* skip_space(const char* s, const char* end) {
+	while(s < end && is_space(*s)) s++;
+	return s;
+}
+
+inline const char* line_end(const char* s, const char* end) {
+	const char* nl = static_cast<const char*>(memchr(s, '\n', end - s));
+	return nl ? nl : end;
+}
+
+inline bool is_digit(char c) {return c >= '0' && c <= '9';}
+
+// Plain decimal/exponent parser, much faster than strtof
+float parse_float(const char*& s, const char* end) {
+	static const double pow10[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9,
+									1e10, 1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18};
+	
+	s = skip_space(s, end);
+	
+	bool neg = false;
+	if(s < end && (*s == '-' || *s == '+')) neg = (*s++ == '-');
+	
+	double value = 0;
+	while(s < end && is_digit(*s)) value = value*10 + (*s++ - '0');
+	
+	if(s < end && *s == '.') {
+		s++;
+		double frac = 0;
+		int digits = 0;
+		while(s < end && is_digit(*s)) {
+			if(digits < 18) {
+				frac = frac*10 + (*s - '0');
+				digits++;
+			}
+			s++;
+		}
+		value += frac / pow10[digits];
+	}
+	
+	if(s < end && (*s == 'e' || *s == 'E')) {
+		s++;
+		bool neg_exp = false;
+		if(s < end && (*s == '-' || *s == '+')) neg_exp = (*s++ == '-');
+		int e = 0;
+		while(s < end && is_digit(*s)) e = e*10 + (*s++ - '0');
+		value *= std::pow(10., neg_exp ? -e : e);
+	}
+	
+	return float(neg ? -value : value);
+}
+
+long parse_int(const char*& s, const char* end) {
+	bool neg = false;
+	if(s < end && (*s == '-' || *s == '+')) neg = (*s++ == '-');
+	
+	long value = 0;
+	while(s < end && is_digit(*s)) value = value*10 + (*s++ - '0');
+	return neg ? -value : value;
+}
+
+// 1-based or negative (relative) OBJ index to 0-based
+// 'count' is the number of elements defined so far
+inline uint32_t resolve(long idx, size_t count, bool& bad) {
+	long abs_idx = (idx > 0) ? idx - 1 : long(count) + idx;
+	if(idx == 0 || abs_idx < 0) {
+		bad = true;
+		return 0;
+	}
+	return uint32_t(abs_idx);
+}
+
+// Tokens of a face line
+int count_corners(const char* s, const char* end) {
+	int corners = 0;
+	while(true) {
+		s = skip_space(s, end);
+		if(s >= end || *s == '#') break;
+		corners++;
+		while(s < end && !is_space(*s)) s++;
+	}
+	return corners;
+}
+
+void count_slice(Slice& sl) {
+	sl.v = sl.vt = sl.vn = sl.tris = 0;
+	
+	for(const char* s = sl.begin; s < sl.end;) {
+		const char* eol = line_end(s, sl.end);
+		s = skip_space(s, eol);
+		
+		if(eol - s > 1) {
+			if(s[0] == 'v') {
+				if(is_space(s[1])) sl.v++;
+				else if(s[1] == 't') sl.vt++;
+				else if(s[1] == 'n') sl.vn++;
+			} else if(s[0] == 'f' && is_space(s[1])) {
+				int corners = count_corners(s + 1, eol);
+				if(corners >= 3) sl.tris += corners - 2;
+			}
+		}
+		
+		s = (eol < sl.end) ? eol + 1 : sl.end;
+	}
+}
+
+// Counts in 'sl' are output offsets at this point
+// 'has_uv/has_normal' tell if the index buffers exist
+void parse_slice(Slice& sl, Mesh_Data& data, bool has_uv, bool has_normal) {
+	size_t v = sl.v, vt = sl.vt, vn = sl.vn, tri = sl.tris;
+	sl.bad = false;
+	
+	for(const char* s = sl.begin; s < sl.end;) {
+		const char* eol = line_end(s, sl.end);
+		s = skip_space(s, eol);
+		
+		if(eol - s > 1 && s[0] == 'v') {
+			if(is_space(s[1])) {
+				float* out = &data.positions[3*v++];
+				s++;
+				for(int a = 0; a < 3; a++) out[a] = parse_float(s, eol);
+			} else if(s[1] == 't') {
+				float* out = &data.uvs[2*vt++];
+				s += 2;
+				for(int a = 0; a < 2; a++) out[a] = parse_float(s, eol);
+			} else if(s[1] == 'n') {
+				float* out = &data.normals[3*vn++];
+				s += 2;
+				for(int a = 0; a < 3; a++) out[a] = parse_float(s, eol);
+			}
+		} else if(eol - s > 1 && s[0] == 'f' && is_space(s[1])) {
+			uint32_t first[3] = {0, 0, 0}, prev[3] = {0, 0, 0};
+			int corner = 0;
+			s++;
+			
+			while(true) {
+				s = skip_space(s, eol);
+				if(s >= eol || *s == '#') break;
+				
+				// v, v/vt, v//vn or v/vt/vn
+				uint32_t cur[3] = {0, 0, 0};
+				cur[0] = resolve(parse_int(s, eol), v, sl.bad);
+				if(s < eol && *s == '/') {
+					s++;
+					if(s < eol && *s != '/') cur[1] = resolve(parse_int(s, eol), vt, sl.bad);
+					if(s < eol && *s == '/') {
+						s++;
+						cur[2] = resolve(parse_int(s, eol), vn, sl.bad);
+					}
+				}
+				while(s < eol && !is_space(*s)) s++;
+				
+				if(corner == 0) {
+					std::copy(cur, cur + 3, first);
+				} else if(corner >= 2) {
+					const size_t o = 3*tri++;
+					data.indices[o] = first[0]; data.indices[o+1] = prev[0]; data.indices[o+2] = cur[0];
+					if(has_uv) {
+						data.uv_indices[o] = first[1]; data.uv_indices[o+1] = prev[1]; data.uv_indices[o+2] = cur[1];
+					}
+					if(has_normal) {
+						data.normal_indices[o] = first[2]; data.normal_indices[o+1] = prev[2]; data.normal_indices[o+2] = cur[2];
+					}
+				}
+				
+				std::copy(cur, cur + 3, prev);
+				corner++;
+			}
+		}
+		
+		s = (eol < sl.end) ? eol + 1 : sl.end;
+	}
+}
+
+// Parses complete lines in [begin, end[, appending to 'data'
+bool parse_block(const char* begin, const char* end, Mesh_Data& data) {
+	const int slice_count = 4 * omp_get_max_threads();
+	std::vector<Slice> slices;
+	slices.reserve(slice_count);
+	
+	const size_t step = (end - begin) / slice_count + 1;
+	for(const char* s = begin; s < end;) {
+		const char* e = (size_t(end - s) <= step) ? end : line_end(s + step, end);
+		if(e < end) e++;
+		slices.push_back({s, e, 0, 0, 0, 0, false});
+		s = e;
+	}
+	
+	const int n = slices.size();
+	
+	#pragma omp parallel for schedule(dynamic)
+	for(int i = 0; i < n; i++)
+		count_slice(slices[i]);
+	
+	// Counts to offsets
+	size_t v = data.positions.size() / 3;
+	size_t vt = data.uvs.size() / 2;
+	size_t vn = data.normals.size() / 3;
+	size_t tris = data.indices.size() / 3;
+	const size_t prev_tris = tris;
+	
+	for(Slice& sl : slices) {
+		size_t c;
+		c = sl.v;    sl.v = v;       v += c;
+		c = sl.vt;   sl.vt = vt;     vt += c;
+		c = sl.vn;   sl.vn = vn;     vn += c;
+		c = sl.tris; sl.tris = tris; tris += c;
+	}
+	
+	const bool has_uv = vt > 0;
+	const bool has_normal = vn > 0;
+	
+	data.positions.resize(3*v);
+	data.uvs.resize(2*vt);
+	data.normals.resize(3*vn);
+	data.indices.resize(3*tris);
+	
+	// Faces read before the first 'vt'/'vn' get index 0
+	if(has_uv) {
+		if(data.uv_indices.empty()) data.uv_indices.resize(3*prev_tris, 0);
+		data.uv_indices.resize(3*tris);
+	}
+	if(has_normal) {
+		if(data.normal_indices.empty()) data.normal_indices.resize(3*prev_tris, 0);
+		data.normal_indices.resize(3*tris);
+	}
+	
+	bool bad = false;
+	
+	#pragma omp parallel for schedule(dynamic) reduction(||:bad)
+	for(int i = 0; i < n; i++) {
+		parse_slice(slices[i], data, has_uv, has_normal);
+		bad = bad || slices[i].bad;
+	}
+	
+	return !bad;
+}
+
+bool indices_in_range(const std::vector<uint32_t>& ids, size_t count) {
+	bool ok = true;
+	const long n = ids.size();
+	
+	#pragma omp parallel for reduction(&&:ok)
+	for(long i = 0; i < n; i++)
+		ok = ok && ids[i] < count;
+	
+	return ok;
+}
+
+}
+
+shared_ptr<Triangle_Mesh> load_OBJ(const char* filename, shared_ptr<IMaterial> mat) {
+	FILE* file = fopen(filename, "rb");
+	if(!file) {
+		perror("Could not open OBJ file");
+		return nullptr;
+	}
+	
+	Mesh_Data data;
+	std::vector<char> buffer;
+	size_t carry = 0;
+	bool ok = true;
+	
+	while(ok) {
+		buffer.resize(carry + block_size);
+		size_t got = fread(buffer.data() + carry, 1, block_size, file);
+		size_t len = carry + got;
+		bool eof = got < block_size;
+		
+		// Cut after the last complete line, the rest is carried over
+		size_t cut = len;
+		if(!eof) {
+			while(cut > 0 && buffer[cut-1] != '\n') cut--;
+			if(cut == 0) cut = len;
+		}
+		
+		ok = parse_block(buffer.data(), buffer.data() + cut, data);
+		
+		carry = len - cut;
+		memmove(buffer.data(), buffer.data() + cut, carry);
+		
+		if(eof) break;
+	}
+	
+	fclose(file);
+	
+	ok = ok && indices_in_range(data.indices, data.positions.size() / 3)
+			&& indices_in_range(data.uv_indices, data.uvs.size() / 2)
+			&& indices_in_range(data.normal_indices, data.normals.size() / 3);
+	
+	if(!ok) {
+		fprintf(stderr, "Malformed OBJ file: %s\n", filename);
+		return nullptr;
+	}
+	
+	return make_shared<Triangle_Mesh>(std::move(data), mat);
+}
\ No newline at end of file
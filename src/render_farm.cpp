@@ -0,0 +1,346 @@
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <string>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <omp.h>
+
+#include "render_farm.h"
+#include "camera.h"
+#include "sbvh.h"
+#include "scene_cache.h"
+
+// Messages are a header followed by 'size' bytes
+enum Farm_Message : uint32_t {
+	FARM_SCENE,		// Table counts (5 x uint64), then textures, materials, primitives, roots, names
+	FARM_JOB,		// Render_Job
+	FARM_TILE,		// Render_Tile
+	FARM_RESULT,	// Render_Tile, then its 3 planes of floats
+	FARM_QUIT
+};
+
+struct Farm_Header {
+	uint32_t type;
+	uint32_t pad;
+	uint64_t size;
+};
+
+static bool write_all(int fd, const void* data, size_t size) {
+	const char* p = static_cast<const char*>(data);
+	while(size > 0) {
+		ssize_t n = write(fd, p, size);
+		if(n < 0 && errno == EINTR) continue;
+		if(n <= 0) return false;
+		p += n;
+		size -= n;
+	}
+	return true;
+}
+
+static bool read_all(int fd, void* data, size_t size) {
+	char* p = static_cast<char*>(data);
+	while(size > 0) {
+		ssize_t n = read(fd, p, size);
+		if(n < 0 && errno == EINTR) continue;
+		if(n <= 0) return false;
+		p += n;
+		size -= n;
+	}
+	return true;
+}
+
+static bool send_message(int fd, uint32_t type, const std::string& payload) {
+	Farm_Header header = {type, 0, payload.size()};
+	return write_all(fd, &header, sizeof(header)) && write_all(fd, payload.data(), payload.size());
+}
+
+template<typename T>
+static void append(std::string& out, const T* data, size_t count) {
+	out.append(reinterpret_cast<const char*>(data), count * sizeof(T));
+}
+
+// Reads 'count' records at 'pos', false past the end
+template<typename T>
+static bool take(const std::string& in, size_t& pos, size_t count, std::vector<T>& out) {
+	if(count > (in.size() - pos) / sizeof(T)) return false;
+	out.resize(count);
+	memcpy(out.data(), in.data() + pos, count * sizeof(T));
+	pos += count * sizeof(T);
+	return true;
+}
+
+
+// Coordinator
+Render_Farm::Render_Farm(const char* exe, int count, const Scene_Writer& scene, int tile_timeout_ms)
+: tile_timeout_ms(std::max(tile_timeout_ms, 1)) {
+	// Writes to a dead worker fail with EPIPE instead
+	signal(SIGPIPE, SIG_IGN);
+	
+	std::string payload;
+	const uint64_t counts[5] = {
+		scene.textures.size(), scene.materials.size(), scene.primitives.size(),
+		scene.roots.size(), scene.names.size()
+	};
+	append(payload, counts, 5);
+	append(payload, scene.textures.data(), scene.textures.size());
+	append(payload, scene.materials.data(), scene.materials.size());
+	append(payload, scene.primitives.data(), scene.primitives.size());
+	append(payload, scene.roots.data(), scene.roots.size());
+	append(payload, scene.names.data(), scene.names.size());
+	
+	for(int i = 0; i < count; i++) {
+		int fds[2];
+		if(socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) < 0) {
+			perror("Render farm: socketpair");
+			break;
+		}
+		
+		pid_t pid = fork();
+		if(pid < 0) {
+			perror("Render farm: fork");
+			close(fds[0]);
+			close(fds[1]);
+			break;
+		}
+		
+		if(pid == 0) {
+			// Only the worker end survives exec
+			fcntl(fds[1], F_SETFD, 0);
+			
+			// Cores are shared between the workers
+			if(!getenv("OMP_NUM_THREADS")) {
+				char threads[16];
+				snprintf(threads, sizeof(threads), "%d", std::max(1, omp_get_num_procs() / count));
+				setenv("OMP_NUM_THREADS", threads, 1);
+			}
+			
+			char fd_arg[16];
+			snprintf(fd_arg, sizeof(fd_arg), "%d", fds[1]);
+			execl(exe, exe, "--worker", fd_arg, (char*)nullptr);
+			_exit(127);
+		}
+		
+		close(fds[1]);
+		
+		// A stalled worker fails reads and writes past the timeout instead of blocking
+		timeval timeout = {this->tile_timeout_ms / 1000, (this->tile_timeout_ms % 1000) * 1000};
+		setsockopt(fds[0], SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+		setsockopt(fds[0], SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+		
+		workers.push_back({fds[0], int(pid), -1, std::chrono::steady_clock::time_point()});
+		if(!send_message(fds[0], FARM_SCENE, payload))
+			drop(workers.size() - 1, true);
+	}
+}
+
+Render_Farm::~Render_Farm() {
+	while(!workers.empty()) {
+		send_message(workers.back().fd, FARM_QUIT, std::string());
+		drop(workers.size() - 1, false);
+	}
+}
+
+void Render_Farm::drop(size_t w, bool failed) {
+	close(workers[w].fd);
+	if(failed) kill(workers[w].pid, SIGKILL);
+	waitpid(workers[w].pid, nullptr, 0);
+	workers.erase(workers.begin() + w);
+}
+
+bool Render_Farm::render(Float_Image& frame, const Render_Job& job, int tile_size) {
+	frame.resize(job.width, job.height, 3);
+	
+	std::vector<Render_Tile> tiles;
+	for(int y = 0; y < job.height; y += tile_size)
+		for(int x = 0; x < job.width; x += tile_size)
+			tiles.push_back({x, y, std::min(x + tile_size, job.width), std::min(y + tile_size, job.height)});
+	
+	std::deque<int> pending;
+	for(size_t t = 0; t < tiles.size(); t++)
+		pending.push_back(t);
+	size_t done = 0;
+	
+	const std::string job_payload(reinterpret_cast<const char*>(&job), sizeof(job));
+	for(size_t w = workers.size(); w-- > 0;) {
+		workers[w].tile = -1;
+		if(!send_message(workers[w].fd, FARM_JOB, job_payload))
+			drop(w, true);
+	}
+	
+	// A failed worker's tile goes back to the front of the queue
+	auto fail = [&](size_t w) {
+		std::cerr << "Render farm: lost worker " << workers[w].pid << std::endl;
+		if(workers[w].tile >= 0) pending.push_front(workers[w].tile);
+		drop(w, true);
+	};
+	
+	std::vector<float> data;
+	while(done < tiles.size()) {
+		// Idle workers get the next tiles
+		for(size_t w = workers.size(); w-- > 0;) {
+			if(workers[w].tile >= 0 || pending.empty()) continue;
+			workers[w].tile = pending.front();
+			workers[w].deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(tile_timeout_ms);
+			pending.pop_front();
+			
+			const Render_Tile& tile = tiles[workers[w].tile];
+			if(!send_message(workers[w].fd, FARM_TILE, std::string(reinterpret_cast<const char*>(&tile), sizeof(tile))))
+				fail(w);
+		}
+		
+		if(workers.empty()) {
+			std::cerr << "Render farm: no worker left, " << tiles.size() - done << " tiles missing" << std::endl;
+			return false;
+		}
+		
+		// Waits until a result comes in or the earliest tile is overdue
+		auto now = std::chrono::steady_clock::now();
+		auto wake = now + std::chrono::milliseconds(tile_timeout_ms);
+		std::vector<pollfd> fds;
+		for(const Worker& worker : workers) {
+			fds.push_back({worker.fd, POLLIN, 0});
+			if(worker.tile >= 0) wake = std::min(wake, worker.deadline);
+		}
+		
+		const long long wait_ms = std::chrono::duration_cast<std::chrono::milliseconds>(wake - now).count();
+		if(poll(fds.data(), fds.size(), int(std::max(wait_ms + 1, 0LL))) < 0) {
+			if(errno == EINTR) continue;
+			perror("Render farm: poll");
+			return false;
+		}
+		
+		now = std::chrono::steady_clock::now();
+		for(size_t w = workers.size(); w-- > 0;) {
+			if(!fds[w].revents) {
+				if(workers[w].tile >= 0 && now >= workers[w].deadline) {
+					std::cerr << "Render farm: worker " << workers[w].pid << " timed out" << std::endl;
+					fail(w);
+				}
+				continue;
+			}
+			
+			// The result must be the tile the worker was given
+			Farm_Header header;
+			Render_Tile tile;
+			const int t = workers[w].tile;
+			if(t < 0 || !read_all(workers[w].fd, &header, sizeof(header)) || header.type != FARM_RESULT
+				|| header.size != sizeof(tile) + 3 * tiles[t].size() * sizeof(float)
+				|| !read_all(workers[w].fd, &tile, sizeof(tile)) || memcmp(&tile, &tiles[t], sizeof(tile))) {
+				fail(w);
+				continue;
+			}
+			
+			data.resize(3 * tile.size());
+			if(!read_all(workers[w].fd, data.data(), data.size() * sizeof(float))) {
+				fail(w);
+				continue;
+			}
+			
+			const int tile_width = tile.x1 - tile.x0;
+			for(int c = 0; c < 3; c++)
+				for(int y = tile.y0; y < tile.y1; y++)
+					std::copy_n(data.data() + c * tile.size() + size_t(y - tile.y0) * tile_width, tile_width,
+						frame.plane(c) + size_t(y) * job.width + tile.x0);
+			
+			workers[w].tile = -1;
+			done++;
+		}
+	}
+	
+	return true;
+}
+
+
+// Worker
+int farm_worker(int fd) {
+	Farm_Header header;
+	std::string payload;
+	
+	shared_ptr<LBVH> bvh;
+	Camera cam;
+	Render_Job job = {};
+	std::vector<float> tile_data;
+	
+	while(read_all(fd, &header, sizeof(header))) {
+		payload.resize(header.size);
+		if(!read_all(fd, &payload[0], payload.size())) break;
+		
+		switch(header.type) {
+			case FARM_SCENE: {
+				std::vector<uint64_t> counts;
+				Scene_Writer w;
+				std::vector<char> names;
+				size_t pos = 0;
+				if(!take(payload, pos, 5, counts)
+					|| !take(payload, pos, counts[0], w.textures)
+					|| !take(payload, pos, counts[1], w.materials)
+					|| !take(payload, pos, counts[2], w.primitives)
+					|| !take(payload, pos, counts[3], w.roots)
+					|| !take(payload, pos, counts[4], names)) {
+					std::cerr << "Render worker: bad scene" << std::endl;
+					return 1;
+				}
+				w.names.assign(names.begin(), names.end());
+				
+				auto objects = Scene_Cache::instantiate(w);
+				if(objects.empty()) {
+					std::cerr << "Render worker: bad scene" << std::endl;
+					return 1;
+				}
+				bvh = SBVH::build(objects);
+				break;
+			}
+			
+			case FARM_JOB:
+				if(!bvh || payload.size() != sizeof(job)) return 1;
+				memcpy(&job, payload.data(), sizeof(job));
+				
+				cam = Camera(hittable_list(bvh));
+				cam.eye_point = read_vec3(job.eye);
+				cam.foc_point = read_vec3(job.focus);
+				cam.camera_up = read_vec3(job.up);
+				cam.background = read_vec3(job.background);
+				cam.FOV = job.fov;
+				cam.max_bounces = job.max_bounces;
+				#ifdef SAMPLING_MODE
+					cam.samples_per_pixel = job.samples;
+				#endif
+				cam.init_CAMERA(job.width, job.height);
+				break;
+			
+			case FARM_TILE: {
+				Render_Tile tile;
+				if(payload.size() != sizeof(tile) || job.width <= 0) return 1;
+				memcpy(&tile, payload.data(), sizeof(tile));
+				
+				tile_data.resize(3 * tile.size());
+				cam.compute_TILE(tile.x0, tile.y0, tile.x1, tile.y1, job.seed, tile_data.data());
+				
+				Farm_Header reply = {FARM_RESULT, 0, sizeof(tile) + tile_data.size() * sizeof(float)};
+				if(!write_all(fd, &reply, sizeof(reply)) || !write_all(fd, &tile, sizeof(tile))
+					|| !write_all(fd, tile_data.data(), tile_data.size() * sizeof(float)))
+					return 1;
+				break;
+			}
+			
+			case FARM_QUIT:
+				return 0;
+			
+			default:
+				return 1;
+		}
+	}
+	
+	return 0;
+}
\ No newline at end of file
@@ -0,0 +1,360 @@
+#include <algorithm>
+#include <chrono>
+
+#include "sbvh.h"
+
+static const size_t leaf_size = 4;
+
+// LBVH::hit keeps at most depth + 1 entries on its 64-slot stack
+static const int max_depth = 48;
+
+struct SBVH_reference {
+	AABB bbox;
+	uint32_t prim;
+};
+
+// Children are bins [0, bin) and [bin, bins) of 'axis'
+struct SBVH_split {
+	double cost = inf;
+	int axis = -1;
+	int bin = 0;
+	bool spatial = false;
+	size_t duplicates = 0;
+};
+
+struct SBVH_bin {
+	AABB bbox;
+	size_t count = 0;		// Object splits: centroids in the bin
+	size_t entry = 0;		// Spatial splits: references starting / ending in the bin
+	size_t exit = 0;
+};
+
+static interval& axis_of(AABB& box, int axis) {
+	return (axis == 0) ? box.x_i : (axis == 1) ? box.y_i : box.z_i;
+}
+
+static bool is_empty(const AABB& box) {
+	return box.x_i.min > box.x_i.max || box.y_i.min > box.y_i.max || box.z_i.min > box.z_i.max;
+}
+
+static double centroid(const AABB& box, int axis) {
+	const interval& ax = box.axis_interval(axis);
+	return .5 * (ax.min + ax.max);
+}
+
+static int bin_index(double x, double min, double scale, int bins) {
+	return std::min(bins - 1, std::max(0, int((x - min) * scale)));
+}
+
+class SBVH_builder {
+	private:
+		const std::vector<shared_ptr<IHittable>>& objects;
+		const SBVH_params& params;
+		
+		std::vector<bool> splittable;
+		double root_area = 0;
+		size_t duplicates_left = 0;
+		
+		// 'ref' restricted to [lo, hi] along 'axis'
+		AABB clip(const SBVH_reference& ref, int axis, double lo, double hi) const {
+			AABB box = ref.bbox;
+			interval& ax = axis_of(box, axis);
+			ax = interval(std::max(ax.min, lo), std::min(ax.max, hi));
+			
+			AABB clipped;
+			objects[ref.prim] -> clip_bounds(box, clipped);
+			return aabb_intersection(clipped, ref.bbox);
+		}
+		
+		double plane(const AABB& node_box, int axis, int bin) const {
+			const interval& ext = node_box.axis_interval(axis);
+			return (bin == params.bins) ? ext.max : ext.min + bin * ext.size() / params.bins;
+		}
+		
+		// Binned SAH over the centroids
+		// 'overlap' is the area shared by the children of the best split
+		SBVH_split object_split(const std::vector<SBVH_reference>& refs, const AABB& centroid_box, double node_area, double& overlap) const {
+			const int bins = params.bins;
+			SBVH_split best;
+			
+			for(int axis = 0; axis < 3; axis++) {
+				const interval& ext = centroid_box.axis_interval(axis);
+				if(!(ext.size() > 0)) continue;
+				const double scale = bins / ext.size();
+				
+				std::vector<SBVH_bin> bin(bins);
+				for(const SBVH_reference& ref : refs) {
+					SBVH_bin& b = bin[bin_index(centroid(ref.bbox, axis), ext.min, scale, bins)];
+					b.bbox = AABB(b.bbox, ref.bbox);
+					b.count++;
+				}
+				
+				std::vector<AABB> right_box(bins);
+				std::vector<size_t> right_count(bins, 0);
+				AABB acc;
+				size_t count = 0;
+				for(int i = bins - 1; i > 0; i--) {
+					acc = AABB(acc, bin[i].bbox);
+					count += bin[i].count;
+					right_box[i] = acc;
+					right_count[i] = count;
+				}
+				
+				AABB left_box;
+				size_t left_count = 0;
+				for(int i = 1; i < bins; i++) {
+					left_box = AABB(left_box, bin[i-1].bbox);
+					left_count += bin[i-1].count;
+					if(left_count == 0 || right_count[i] == 0) continue;
+					
+					double cost = 1 + (left_box.surface_area() * left_count + right_box[i].surface_area() * right_count[i]) / node_area;
+					if(cost < best.cost) {
+						best.cost = cost;
+						best.axis = axis;
+						best.bin = i;
+						overlap = aabb_intersection(left_box, right_box[i]).surface_area();
+					}
+				}
+			}
+			return best;
+		}
+		
+		// Binned SAH over clipped references, planes evenly spaced in the node box
+		// Unsplittable references stay whole, in the bin of their centroid
+		SBVH_split spatial_split(const std::vector<SBVH_reference>& refs, const AABB& node_box, double node_area) const {
+			const int bins = params.bins;
+			SBVH_split best;
+			
+			for(int axis = 0; axis < 3; axis++) {
+				const interval& ext = node_box.axis_interval(axis);
+				if(!(ext.size() > 0)) continue;
+				const double scale = bins / ext.size();
+				
+				std::vector<SBVH_bin> bin(bins);
+				for(const SBVH_reference& ref : refs) {
+					const interval& ax = ref.bbox.axis_interval(axis);
+					
+					if(!splittable[ref.prim]) {
+						SBVH_bin& b = bin[bin_index(centroid(ref.bbox, axis), ext.min, scale, bins)];
+						b.bbox = AABB(b.bbox, ref.bbox);
+						b.entry++;
+						b.exit++;
+						continue;
+					}
+					
+					const int first = bin_index(ax.min, ext.min, scale, bins);
+					const int last  = bin_index(ax.max, ext.min, scale, bins);
+					for(int b = first; b <= last; b++) {
+						AABB part = (first == last) ? ref.bbox : clip(ref, axis, plane(node_box, axis, b), plane(node_box, axis, b + 1));
+						bin[b].bbox = AABB(bin[b].bbox, part);
+					}
+					bin[first].entry++;
+					bin[last].exit++;
+				}
+				
+				std::vector<AABB> right_box(bins);
+				std::vector<size_t> right_count(bins, 0);
+				AABB acc;
+				size_t count = 0;
+				for(int i = bins - 1; i > 0; i--) {
+					acc = AABB(acc, bin[i].bbox);
+					count += bin[i].exit;
+					right_box[i] = acc;
+					right_count[i] = count;
+				}
+				
+				AABB left_box;
+				size_t left_count = 0;
+				for(int i = 1; i < bins; i++) {
+					left_box = AABB(left_box, bin[i-1].bbox);
+					left_count += bin[i-1].entry;
+					
+					// Both sides must shrink, within the duplication budget
+					if(left_count == 0 || right_count[i] == 0) continue;
+					if(left_count == refs.size() || right_count[i] == refs.size()) continue;
+					const size_t duplicates = left_count + right_count[i] - refs.size();
+					if(duplicates > duplicates_left) continue;
+					
+					double cost = 1 + (left_box.surface_area() * left_count + right_box[i].surface_area() * right_count[i]) / node_area;
+					if(cost < best.cost) {
+						best.cost = cost;
+						best.axis = axis;
+						best.bin = i;
+						best.spatial = true;
+						best.duplicates = duplicates;
+					}
+				}
+			}
+			return best;
+		}
+		
+		void partition_objects(const std::vector<SBVH_reference>& refs, const SBVH_split& split, const AABB& centroid_box,
+			std::vector<SBVH_reference>& left, std::vector<SBVH_reference>& right) const {
+			const interval& ext = centroid_box.axis_interval(split.axis);
+			const double scale = params.bins / ext.size();
+			
+			for(const SBVH_reference& ref : refs) {
+				if(bin_index(centroid(ref.bbox, split.axis), ext.min, scale, params.bins) < split.bin)
+					left.push_back(ref);
+				else
+					right.push_back(ref);
+			}
+		}
+		
+		// References crossing the plane are clipped to each side
+		// Once the budget is spent, they go whole to the side of their centroid
+		void partition_spatial(const std::vector<SBVH_reference>& refs, const SBVH_split& split, const AABB& node_box,
+			std::vector<SBVH_reference>& left, std::vector<SBVH_reference>& right) {
+			const int axis = split.axis;
+			const double pos = plane(node_box, axis, split.bin);
+			
+			for(const SBVH_reference& ref : refs) {
+				const interval& ax = ref.bbox.axis_interval(axis);
+				
+				if(ax.max <= pos) {
+					left.push_back(ref);
+					continue;
+				}
+				if(ax.min >= pos) {
+					right.push_back(ref);
+					continue;
+				}
+				if(!splittable[ref.prim] || duplicates_left == 0) {
+					(centroid(ref.bbox, axis) < pos ? left : right).push_back(ref);
+					continue;
+				}
+				
+				const AABB left_part  = clip(ref, axis, -inf, pos);
+				const AABB right_part = clip(ref, axis, pos, +inf);
+				const bool in_left = !is_empty(left_part), in_right = !is_empty(right_part);
+				
+				if(in_left)  left.push_back({left_part, ref.prim});
+				if(in_right) right.push_back({right_part, ref.prim});
+				if(in_left && in_right) duplicates_left--;
+				if(!in_left && !in_right) left.push_back(ref);
+			}
+		}
+		
+		uint32_t make_leaf(uint32_t idx, const std::vector<SBVH_reference>& refs) {
+			BVH_node& node = nodes[idx];
+			node.left = primitives_register.size();
+			node.right = refs.size();
+			node.leaf = true;
+			node.axis = 0;
+			for(const SBVH_reference& ref : refs)
+				primitives_register.push_back(objects[ref.prim]);
+			return idx;
+		}
+	
+	public:
+		std::vector<BVH_node> nodes;
+		std::vector<shared_ptr<IHittable>> primitives_register;
+		
+		SBVH_builder(const std::vector<shared_ptr<IHittable>>& objects, const SBVH_params& params)
+		: objects(objects), params(params), splittable(objects.size()) {}
+		
+		std::vector<SBVH_reference> references() {
+			std::vector<SBVH_reference> refs(objects.size());
+			AABB root;
+			for(size_t i = 0; i < objects.size(); i++) {
+				refs[i] = {objects[i] -> bounding_box(), uint32_t(i)};
+				root = AABB(root, refs[i].bbox);
+				
+				AABB unused;
+				splittable[i] = objects[i] -> clip_bounds(AABB::universe, unused);
+			}
+			
+			root_area = std::max(root.surface_area(), 1e-12);
+			duplicates_left = size_t(params.duplication_budget * objects.size());
+			nodes.reserve(objects.size() * 2);
+			primitives_register.reserve(objects.size() + duplicates_left);
+			return refs;
+		}
+		
+		// Same preorder layout as LBVH::construct, children after their parent
+		uint32_t construct(std::vector<SBVH_reference>& refs, int depth) {
+			const uint32_t idx = nodes.size();
+			nodes.emplace_back();
+			
+			AABB bbox;
+			interval centroid_axes[3];
+			for(const SBVH_reference& ref : refs) {
+				bbox = AABB(bbox, ref.bbox);
+				for(int a = 0; a < 3; a++) {
+					const double c = centroid(ref.bbox, a);
+					centroid_axes[a] = interval(centroid_axes[a], interval(c, c));
+				}
+			}
+			AABB centroid_box;
+			centroid_box.x_i = centroid_axes[0];
+			centroid_box.y_i = centroid_axes[1];
+			centroid_box.z_i = centroid_axes[2];
+			nodes[idx].bbox = bbox;
+			
+			if(refs.size() <= leaf_size || depth >= max_depth) return make_leaf(idx, refs);
+			
+			const double node_area = std::max(bbox.surface_area(), 1e-300);
+			double overlap = 0;
+			SBVH_split split = object_split(refs, centroid_box, node_area, overlap);
+			
+			if(overlap / root_area > params.overlap_threshold && duplicates_left > 0) {
+				SBVH_split spatial = spatial_split(refs, bbox, node_area);
+				if(spatial.cost < split.cost) split = spatial;
+			}
+			
+			// All centroids in one spot and no useful plane
+			if(split.axis < 0) return make_leaf(idx, refs);
+			
+			std::vector<SBVH_reference> left, right;
+			if(split.spatial) {
+				partition_spatial(refs, split, bbox, left, right);
+				
+				if(left.empty() || right.empty()) {
+					left.clear();
+					right.clear();
+					split = object_split(refs, centroid_box, node_area, overlap);
+					if(split.axis < 0) return make_leaf(idx, refs);
+					partition_objects(refs, split, centroid_box, left, right);
+				}
+			} else {
+				partition_objects(refs, split, centroid_box, left, right);
+			}
+			
+			// Released before going deeper
+			std::vector<SBVH_reference>().swap(refs);
+			
+			const uint32_t left_child  = construct(left, depth + 1);
+			const uint32_t right_child = construct(right, depth + 1);
+			
+			BVH_node& node = nodes[idx];
+			node.left  = left_child;
+			node.right = right_child;
+			node.leaf  = false;
+			node.axis  = split.axis;
+			return idx;
+		}
+};
+
+
+shared_ptr<LBVH> SBVH::build(const std::vector<shared_ptr<IHittable>>& objects, const SBVH_params& params) {
+	if(objects.empty()) return make_shared<LBVH>(objects);
+	
+	auto build_start = std::chrono::steady_clock::now();
+	
+	SBVH_builder builder(objects, params);
+	std::vector<SBVH_reference> refs = builder.references();
+	
+	auto construct_start = std::chrono::steady_clock::now();
+	builder.construct(refs, 0);
+	
+	// Adopted like a cached tree, the node array lives as long as the LBVH
+	auto storage = make_shared<std::vector<BVH_node>>(std::move(builder.nodes));
+	auto bvh = make_shared<LBVH>(storage->data(), storage->size(), std::move(builder.primitives_register), storage);
+	
+	auto build_end = std::chrono::steady_clock::now();
+	typedef std::chrono::duration<double, std::milli> ms;
+	bvh->build_times.bounds_ms	  = ms(construct_start - build_start).count();
+	bvh->build_times.construct_ms = ms(build_end - construct_start).count();
+	bvh->build_times.total_ms	  = ms(build_end - build_start).count();
+	return bvh;
+}
\ No newline at end of file
@@ -0,0 +1,397 @@
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "scene_cache.h"
+
+static const char cache_magic[8] = {'R', 'T', 'C', 'A', 'C', 'H', 'E', '\0'};
+static const uint64_t section_align = 64;
+
+static const size_t elem_size[Cache_Header::SECTION_COUNT] = {
+	sizeof(texture_record), sizeof(material_record), sizeof(primitive_record),
+	sizeof(uint32_t), sizeof(uint32_t), sizeof(BVH_node), 1
+};
+
+
+uint32_t Scene_Writer::add(const ITexture* tex) {
+	if(!tex) return none;
+	
+	auto it = ids.find(tex);
+	if(it != ids.end()) return it->second;
+	
+	uint32_t idx = tex -> serialize(*this);
+	if(idx == none) complete = false;
+	return ids[tex] = idx;
+}
+
+uint32_t Scene_Writer::add(const IMaterial* mat) {
+	if(!mat) return none;
+	
+	auto it = ids.find(mat);
+	if(it != ids.end()) return it->second;
+	
+	uint32_t idx = mat -> serialize(*this);
+	if(idx == none) complete = false;
+	return ids[mat] = idx;
+}
+
+uint32_t Scene_Writer::add(const IHittable* obj) {
+	if(!obj) return none;
+	
+	auto it = ids.find(obj);
+	if(it != ids.end()) return it->second;
+	
+	uint32_t idx = obj -> serialize(*this);
+	if(idx == none) complete = false;
+	return ids[obj] = idx;
+}
+
+static void fnv1a(uint64_t& h, const void* data, size_t size) {
+	const unsigned char* bytes = static_cast<const unsigned char*>(data);
+	for(size_t i = 0; i < size; i++) {
+		h ^= bytes[i];
+		h *= 0x100000001b3ULL;
+	}
+}
+
+template<typename T>
+static void fnv1a(uint64_t& h, const std::vector<T>& v) {
+	uint64_t n = v.size();
+	fnv1a(h, &n, sizeof(n));
+	fnv1a(h, v.data(), n * sizeof(T));
+}
+
+uint64_t Scene_Writer::hash() const {
+	uint64_t h = 0xcbf29ce484222325ULL;
+	fnv1a(h, textures);
+	fnv1a(h, materials);
+	fnv1a(h, primitives);
+	fnv1a(h, roots);
+	fnv1a(h, names.data(), names.size());
+	return h;
+}
+
+// Tables and the configuration the tree was built with
+static uint64_t content_hash(const Scene_Writer& w, uint32_t build) {
+	uint64_t h = w.hash();
+	fnv1a(h, &build, sizeof(build));
+	return h;
+}
+
+// Hash of the running executable, 0 if it can't be read
+// Computed once, the binary does not change under a running process.
+static uint64_t executable_hash() {
+	static const uint64_t hash = [] {
+		FILE* file = fopen("/proc/self/exe", "rb");
+		if(!file) return uint64_t(0);
+		
+		uint64_t h = 0xcbf29ce484222325ULL;
+		char buffer[1 << 16];
+		size_t n;
+		while((n = fread(buffer, 1, sizeof(buffer), file)) > 0)
+			fnv1a(h, buffer, n);
+		
+		const bool ok = !ferror(file);
+		fclose(file);
+		return ok ? h : uint64_t(0);
+	}();
+	return hash;
+}
+
+uint64_t Scene_Cache::recipe_key(const std::string& recipe) {
+	const uint64_t binary = executable_hash();
+	if(binary == 0) return 0;
+	
+	uint64_t h = 0xcbf29ce484222325ULL;
+	fnv1a(h, &binary, sizeof(binary));
+	fnv1a(h, recipe.data(), recipe.size());
+	return h ? h : 1;
+}
+
+
+Scene_Writer Scene_Cache::describe(const hittable_list& scene) {
+	Scene_Writer w;
+	for(const auto& obj : scene.objects)
+		w.roots.push_back(w.add(obj.get()));
+	return w;
+}
+
+bool Scene_Cache::save(const char* path, const hittable_list& scene, const LBVH& bvh, uint32_t build, uint64_t recipe) {
+	Scene_Writer w = describe(scene);
+	if(!w.complete) {
+		std::cerr << "Scene cache skipped: some objects cannot be serialized" << std::endl;
+		return false;
+	}
+	
+	// BVH primitives as indices into the scene objects
+	std::unordered_map<const IHittable*, uint32_t> scene_index;
+	for(size_t i = 0; i < scene.objects.size(); i++)
+		scene_index[scene.objects[i].get()] = i;
+	
+	std::vector<uint32_t> reg;
+	reg.reserve(bvh.primitives().size());
+	for(const auto& prim : bvh.primitives()) {
+		auto it = scene_index.find(prim.get());
+		if(it == scene_index.end()) return false;
+		reg.push_back(it->second);
+	}
+	
+	Cache_Header header = {};
+	memcpy(header.magic, cache_magic, sizeof(cache_magic));
+	header.version = version;
+	header.node_size = sizeof(BVH_node);
+	header.content_hash = content_hash(w, build);
+	header.recipe = recipe;
+	header.build = build;
+	
+	const void* data[Cache_Header::SECTION_COUNT] = {
+		w.textures.data(), w.materials.data(), w.primitives.data(),
+		w.roots.data(), reg.data(), bvh.tree_nodes(), w.names.data()
+	};
+	header.count[Cache_Header::TEXTURES]   = w.textures.size();
+	header.count[Cache_Header::MATERIALS]  = w.materials.size();
+	header.count[Cache_Header::PRIMITIVES] = w.primitives.size();
+	header.count[Cache_Header::ROOTS]	   = w.roots.size();
+	header.count[Cache_Header::REGISTER]   = reg.size();
+	header.count[Cache_Header::NODES]	   = bvh.tree_node_count();
+	header.count[Cache_Header::NAMES]	   = w.names.size();
+	
+	uint64_t offset = sizeof(Cache_Header);
+	for(int s = 0; s < Cache_Header::SECTION_COUNT; s++) {
+		offset = (offset + section_align - 1) / section_align * section_align;
+		header.offset[s] = offset;
+		offset += header.count[s] * elem_size[s];
+	}
+	
+	// Written under a temporary name, so a crash never leaves a truncated cache
+	std::string tmp_path = std::string(path) + ".tmp";
+	FILE* file = fopen(tmp_path.c_str(), "wb");
+	if(!file) {
+		perror("Could not write scene cache");
+		return false;
+	}
+	
+	bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+	static const char zeros[section_align] = {};
+	uint64_t written = sizeof(header);
+	for(int s = 0; s < Cache_Header::SECTION_COUNT && ok; s++) {
+		ok = fwrite(zeros, 1, header.offset[s] - written, file) == header.offset[s] - written;
+		size_t bytes = header.count[s] * elem_size[s];
+		ok = ok && (bytes == 0 || fwrite(data[s], 1, bytes, file) == bytes);
+		written = header.offset[s] + bytes;
+	}
+	
+	ok = (fclose(file) == 0) && ok;
+	ok = ok && rename(tmp_path.c_str(), path) == 0;
+	if(!ok) {
+		perror("Could not write scene cache");
+		remove(tmp_path.c_str());
+	}
+	return ok;
+}
+
+// Maps 'path' and checks its header and section bounds
+// Returns the header, nullptr if the file is missing or not a valid cache
+static const Cache_Header* map_cache(const char* path, std::shared_ptr<const void>& mapping) {
+	int fd = open(path, O_RDONLY);
+	if(fd < 0) return nullptr;
+	
+	struct stat st;
+	if(fstat(fd, &st) != 0 || size_t(st.st_size) < sizeof(Cache_Header)) {
+		close(fd);
+		return nullptr;
+	}
+	
+	const size_t size = st.st_size;
+	void* addr = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(addr == MAP_FAILED) return nullptr;
+	
+	// Unmapped once the last LBVH using it goes away
+	mapping = std::shared_ptr<const void>(addr, [size](const void* p) {
+		munmap(const_cast<void*>(p), size);
+	});
+	
+	const Cache_Header& header = *static_cast<const Cache_Header*>(addr);
+	
+	if(memcmp(header.magic, cache_magic, sizeof(cache_magic)) != 0
+		|| header.version != Scene_Cache::version
+		|| header.node_size != sizeof(BVH_node))
+		return nullptr;
+	
+	for(int s = 0; s < Cache_Header::SECTION_COUNT; s++) {
+		if(header.offset[s] % section_align != 0
+			|| header.offset[s] > size
+			|| header.count[s] > (size - header.offset[s]) / elem_size[s])
+			return nullptr;
+	}
+	return &header;
+}
+
+// Copy of the tables of a mapped cache
+template<typename T>
+static std::vector<T> read_section(const Cache_Header& header, int s) {
+	const T* first = reinterpret_cast<const T*>(reinterpret_cast<const char*>(&header) + header.offset[s]);
+	return std::vector<T>(first, first + header.count[s]);
+}
+
+static Scene_Writer read_tables(const Cache_Header& header) {
+	Scene_Writer w;
+	w.textures	 = read_section<texture_record>(header, Cache_Header::TEXTURES);
+	w.materials	 = read_section<material_record>(header, Cache_Header::MATERIALS);
+	w.primitives = read_section<primitive_record>(header, Cache_Header::PRIMITIVES);
+	w.roots		 = read_section<uint32_t>(header, Cache_Header::ROOTS);
+	
+	const char* names = reinterpret_cast<const char*>(&header) + header.offset[Cache_Header::NAMES];
+	w.names.assign(names, header.count[Cache_Header::NAMES]);
+	return w;
+}
+
+// Tree of a mapped cache, its register resolved against 'objects'
+static shared_ptr<LBVH> adopt_tree(const Cache_Header& header, const std::vector<shared_ptr<IHittable>>& objects,
+	std::shared_ptr<const void> mapping) {
+	
+	const char* base = reinterpret_cast<const char*>(&header);
+	const uint32_t* reg = reinterpret_cast<const uint32_t*>(base + header.offset[Cache_Header::REGISTER]);
+	const size_t reg_count = header.count[Cache_Header::REGISTER];
+	
+	std::vector<shared_ptr<IHittable>> primitives(reg_count);
+	for(size_t i = 0; i < reg_count; i++) {
+		if(reg[i] >= objects.size()) return nullptr;
+		primitives[i] = objects[reg[i]];
+	}
+	
+	const BVH_node* nodes = reinterpret_cast<const BVH_node*>(base + header.offset[Cache_Header::NODES]);
+	const size_t node_count = header.count[Cache_Header::NODES];
+	
+	// Children are stored after their parent and leaves stay inside the register
+	for(size_t i = 0; i < node_count; i++) {
+		const BVH_node& node = nodes[i];
+		bool valid = node.leaf ? (uint64_t(node.left) + node.right <= reg_count)
+							   : (node.left > i && node.right > i && node.left < node_count && node.right < node_count);
+		if(!valid) return nullptr;
+	}
+	
+	return make_shared<LBVH>(nodes, node_count, std::move(primitives), mapping);
+}
+
+shared_ptr<LBVH> Scene_Cache::load(const char* path, const hittable_list& scene, uint32_t build) {
+	std::shared_ptr<const void> mapping;
+	const Cache_Header* header = map_cache(path, mapping);
+	if(!header || header->build != build) return nullptr;
+	
+	Scene_Writer w = describe(scene);
+	if(!w.complete || content_hash(w, build) != header->content_hash) return nullptr;
+	
+	return adopt_tree(*header, scene.objects, mapping);
+}
+
+shared_ptr<LBVH> Scene_Cache::load_scene(const char* path, uint64_t recipe, uint32_t build, hittable_list& scene) {
+	std::shared_ptr<const void> mapping;
+	const Cache_Header* header = map_cache(path, mapping);
+	if(!header || recipe == 0 || header->recipe != recipe || header->build != build) return nullptr;
+	
+	// The hash still guards against a damaged file
+	Scene_Writer w = read_tables(*header);
+	if(content_hash(w, build) != header->content_hash) return nullptr;
+	
+	std::vector<shared_ptr<IHittable>> objects = instantiate(w);
+	if(objects.empty() && !w.roots.empty()) return nullptr;
+	
+	auto bvh = adopt_tree(*header, objects, mapping);
+	if(!bvh) return nullptr;
+	
+	scene.clear();
+	for(const auto& obj : objects)
+		scene.add(obj);
+	return bvh;
+}
+
+std::vector<shared_ptr<IHittable>> Scene_Cache::instantiate(const Scene_Writer& w) {
+	std::vector<shared_ptr<ITexture>>  textures;
+	std::vector<shared_ptr<IMaterial>> materials;
+	std::vector<shared_ptr<IHittable>> primitives;
+	
+	// Children always come first, anything else is rejected
+	auto tex = [&textures](uint32_t i) {return (i < textures.size()) ? textures[i] : nullptr;};
+	
+	for(const texture_record& rec : w.textures) {
+		shared_ptr<ITexture> t;
+		switch(rec.type) {
+			case TEX_UNIFORM:
+				t = make_shared<Uniform_Color>(read_vec3(rec.albedo));
+				break;
+			case TEX_CHECKER:
+				if(tex(rec.even) && tex(rec.odd))
+					t = make_shared<Checker_Texture>(rec.scale, tex(rec.even), tex(rec.odd));
+				break;
+			case TEX_LOLLIPOP:
+				if(tex(rec.even) && tex(rec.odd))
+					t = make_shared<Lollipop_Texture>(rec.scale, tex(rec.even), tex(rec.odd));
+				break;
+			case TEX_IMAGE:
+				if(rec.name < w.names.size())
+					t = make_shared<IMG_Texture>(w.names.c_str() + rec.name);
+				break;
+		}
+		if(!t) return {};
+		textures.push_back(t);
+	}
+	
+	for(const material_record& rec : w.materials) {
+		shared_ptr<IMaterial> m;
+		switch(rec.type) {
+			case MAT_LAMBERTIAN:
+				if(tex(rec.tex)) m = make_shared<Lambertian>(tex(rec.tex));
+				break;
+			case MAT_METAL:
+				m = make_shared<Metal>(read_vec3(rec.albedo), rec.param);
+				break;
+			case MAT_DIELECTRIC:
+				m = make_shared<Dielectric>(rec.param);
+				break;
+			case MAT_EMITTER:
+				if(tex(rec.tex)) m = make_shared<Emitter>(tex(rec.tex));
+				break;
+			case MAT_ISOTROPIC:
+				if(tex(rec.tex)) m = make_shared<Isotropic>(tex(rec.tex));
+				break;
+		}
+		if(!m) return {};
+		materials.push_back(m);
+	}
+	
+	for(const primitive_record& rec : w.primitives) {
+		shared_ptr<IHittable> p;
+		switch(rec.type) {
+			case PRIM_SPHERE:
+				if(rec.mat < materials.size())
+					p = make_shared<Sphere>(read_vec3(rec.data), read_vec3(rec.data + 3), rec.data[6], materials[rec.mat]);
+				break;
+			case PRIM_QUAD:
+				if(rec.mat < materials.size())
+					p = make_shared<Quad>(read_vec3(rec.data), read_vec3(rec.data + 3), read_vec3(rec.data + 6), materials[rec.mat]);
+				break;
+			case PRIM_CONSTANT_MEDIUM:
+				// The phase function is rebuilt from its texture
+				if(rec.boundary < primitives.size() && rec.mat < materials.size() && tex(w.materials[rec.mat].tex))
+					p = make_shared<Constant_Medium>(primitives[rec.boundary], rec.data[0], tex(w.materials[rec.mat].tex));
+				break;
+		}
+		if(!p) return {};
+		primitives.push_back(p);
+	}
+	
+	std::vector<shared_ptr<IHittable>> objects;
+	objects.reserve(w.roots.size());
+	for(uint32_t root : w.roots) {
+		if(root >= primitives.size()) return {};
+		objects.push_back(primitives[root]);
+	}
+	return objects;
+}
\ No newline at end of file
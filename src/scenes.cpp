@@ -0,0 +1,428 @@
+#include <iostream>
+#include <algorithm>
+#include <cmath>
+#include <chrono>
+#include <random>
+
+using namespace std;
+
+#include "scenes.h"
+#include "lbvh.h"
+
+void scene_origScene(hittable_list& scene) {
+	
+	auto checker = make_shared<Checker_Texture>(.3, color(.1), color(.9));
+	
+	auto mat_center = make_shared<Metal>(color(.3), 0);
+	auto mat_ground = make_shared<Lambertian>(checker);
+	auto mat_sphsky = make_shared<Metal>(color(.9, .3, .3), .3);
+	auto mat_spher1 = make_shared<Metal>(color(.7, .6, .2), .7);
+	auto mat_spher2 = make_shared<Lambertian>(color(.2, .6, .7));
+	auto mat_spher3 = make_shared<Dielectric>(1./1.33);
+	auto mat_spher4 = make_shared<Dielectric>(2.5);
+	
+	
+	scene.add(make_shared<Sphere>(point3(0,0,-.5),	.25, mat_center));
+	scene.add(make_shared<Sphere>(point3(10,10,-20), 10, mat_sphsky));
+	scene.add(make_shared<Sphere>(point3(0,-30.5,-1),30, mat_ground));
+	scene.add(make_shared<Sphere>(point3(-10,5,-10),  3, mat_spher1));
+	scene.add(make_shared<Sphere>(point3(-10,5,-2), point3(-10,2,-2), 5, mat_spher2));
+	scene.add(make_shared<Sphere>(point3(-10,2,-10),  4, mat_spher3));
+	scene.add(make_shared<Sphere>(point3(5,2,-10),    4, mat_spher4));
+}
+
+void scene_bookScene(hittable_list& scene) {
+	// Scene from Raytracing in One Weekend
+	
+	auto ground_material = make_shared<Lambertian>(color(0.5, 0.5, 0.5));
+    scene.add(make_shared<Sphere>(point3(0,-1000,0), 1000, ground_material));
+
+    for (int a = -5; a < 5; a++) {
+        for (int b = -5; b < 5; b++) {
+            auto choose_mat = get_rand_double();
+            point3 center(a + 0.9*get_rand_double(), 0.2, b + 0.9*get_rand_double());
+
+            if ((center - point3(4, 0.2, 0)).len() > 0.9) {
+                shared_ptr<IMaterial> sphere_material;
+
+                if (choose_mat < 0.8) {
+                    // Diffuse
+                    auto albedo = color::random() * color::random();
+                    sphere_material = make_shared<Lambertian>(albedo);
+					auto center2 = center + vec3(0,get_rand_double(0, 1),0);
+                    scene.add(make_shared<Sphere>(center, center2, 0.2, sphere_material));
+                } else if (choose_mat < 0.95) {
+                    // Metal
+                    auto albedo = color::random(0.5, 1);
+                    auto fuzz = get_rand_double(0, 0.5);
+                    sphere_material = make_shared<Metal>(albedo, fuzz);
+                    scene.add(make_shared<Sphere>(center, 0.2, sphere_material));
+                } else {
+                    // Glass
+                    sphere_material = make_shared<Dielectric>(1.5);
+                    scene.add(make_shared<Sphere>(center, 0.2, sphere_material));
+                }
+            }
+        }
+    }
+
+    auto material1 = make_shared<Dielectric>(1.5);
+    scene.add(make_shared<Sphere>(point3(0, 1, 0), 1.0, material1));
+
+    auto material2 = make_shared<Lambertian>(color(0.4, 0.2, 0.1));
+    scene.add(make_shared<Sphere>(point3(-4, 1, 0), 1.0, material2));
+
+    auto material3 = make_shared<Metal>(color(0.7, 0.6, 0.5), 0.0);
+    scene.add(make_shared<Sphere>(point3(4, 1, 0), 1.0, material3));
+	
+	
+}
+
+void scene_earthScene(hittable_list& scene) {
+	
+    auto earth_texture = make_shared<IMG_Texture>("1024px-Nasa_land_ocean_ice_8192.jpg");
+    auto earth_surface = make_shared<Lambertian>(earth_texture);
+    auto globe = make_shared<Sphere>(point3(0,2,0), 2, earth_surface);
+	
+	auto checker = make_shared<Checker_Texture>(.3, color(.1), color(.9));
+	auto mat_ground = make_shared<Lambertian>(checker);
+	auto ground = make_shared<Sphere>(point3(0,-30.5,-1),30, mat_ground);
+	
+	auto mat_sphsky = make_shared<Dielectric>(2.5);
+	auto glass = make_shared<Sphere>(point3(5,5,-20), 10, mat_sphsky);
+	
+	auto mat_marble = make_shared<Lambertian>(color(.2, .6, .7));
+	auto marble = make_shared<Sphere>(point3(-15, 5, -10), 5, mat_marble);
+	
+	auto mat_metal = make_shared<Metal>(color(.7, .6, .2), .7);
+	auto metal_ball = make_shared<Sphere>(point3(-20, 3,-7),  4, mat_metal);
+	
+	auto mat_light = make_shared<Emitter>(color(10));
+	auto light_ball = make_shared<Sphere>(point3(3,1,1), .5, mat_light);
+	
+	// auto lollipop = make_shared<Lollipop_Texture>(10, color(0), color(90, .1, .4));
+	// auto mat_lollipop = make_shared<Emitter>(lollipop);
+	// auto sph_lolli = make_shared<Sphere>(point3(-5,2,0), 1.5, mat_lollipop);
+	
+	auto sph_gas_shape = make_shared<Sphere>(point3(-5,2,0), 1.5,make_shared<Lambertian>(color(1)));
+	
+	auto sph_gas = make_shared<Constant_Medium>(sph_gas_shape, 0.5, color(1));
+	
+	auto lollipop2 = make_shared<Lollipop_Texture>(15, color(.4,90,.1), color(.2,.1,90));
+	auto mat_lollipop2 = make_shared<Emitter>(lollipop2);
+	auto pla_lolli = make_shared<Quad>(point3(-5,-2,3),vec3(0,3,0),vec3(3,0,3),mat_lollipop2);
+	
+	
+	scene.add(globe);
+	scene.add(ground);
+	scene.add(glass);
+	scene.add(marble);
+	scene.add(metal_ball);
+	scene.add(light_ball);
+	scene.add(sph_gas);
+	// scene.add(sph_lolli);
+	scene.add(pla_lolli);
+}
+
+// Walls, floor, ceiling and light panel of the Cornell box, inside [-dim/2, dim/2] x [0, dim] x [0, dim]
+static void cornell_box(hittable_list& scene, float dim) {
+	
+	auto green_mat = make_shared<Lambertian>(color(0, 1, 0));
+	auto red_mat   = make_shared<Lambertian>(color(1, 0, 0));
+	auto blue_mat  = make_shared<Lambertian>(color(0, 0, 1));
+	auto white_mat = make_shared<Lambertian>(color(1));
+	auto emit_mat  = make_shared<Emitter>(color(10));
+	
+	auto left_wall = make_shared<Quad>(
+		point3(-dim/2.,0,0),
+		vec3(0,dim,0),
+		vec3(0,0,dim),
+	red_mat);
+	
+	auto right_wall = make_shared<Quad>(
+		point3(dim/2.,0,0),
+		vec3(0,dim,0),
+		vec3(0,0,dim),
+	green_mat);
+	
+	auto back_wall = make_shared<Quad>(
+		point3(-dim/2.,0,0),
+		vec3(0,dim,0),
+		vec3(dim,0,0),
+	blue_mat);
+	
+	auto ground = make_shared<Quad>(
+		point3(-dim/2.,0,0),
+		vec3(0,0,dim),
+		vec3(dim,0,0),
+	white_mat);
+	
+	auto ceiling = make_shared<Quad>(
+		point3(-dim/2.,dim,0),
+		vec3(0,0,dim),
+		vec3(dim,0,0),
+	white_mat);
+	
+	auto light_panel = make_shared<Quad>(
+		point3(-dim/2.+dim/3,dim-dim/100,dim/3),
+		vec3(0,0,dim/3),
+		vec3(dim/3,0,0),
+	emit_mat);
+	
+	scene.add(left_wall);
+	scene.add(right_wall);
+	scene.add(back_wall);
+	scene.add(ground);
+	scene.add(ceiling);
+	scene.add(light_panel);
+}
+
+void scene_cornellScene(hittable_list& scene, float dim) {
+	
+	// auto glass_mat = make_shared<Dielectric>(2);
+	auto metal_mat = make_shared<Metal>(color(.5), 0);
+	
+	
+	auto earth_texture = make_shared<IMG_Texture>("1024px-Nasa_land_ocean_ice_8192.jpg");
+    auto earth_surface = make_shared<Lambertian>(earth_texture);
+	
+	auto globe = make_shared<Sphere>(point3(0,dim/2,0), dim/3, earth_surface);
+	// auto glass = make_shared<Sphere>(point3(-dim/4,dim/2-dim/4,dim/3), dim/5, glass_mat);
+	auto metal = make_shared<Sphere>(point3(dim/4,dim/2-dim/4,dim/3), dim/5, metal_mat);
+	
+	auto sph_gas_shape = make_shared<Sphere>(point3(-dim/4,dim/2-dim/4,dim/3), dim/5,make_shared<Lambertian>(color(0.7)));
+	
+	auto sph_gas = make_shared<Constant_Medium>(sph_gas_shape, 0.5, color(0.7));
+	
+	cornell_box(scene, dim);
+	scene.add(globe);
+	// scene.add(glass);
+	scene.add(sph_gas);
+	scene.add(metal);
+}
+
+// Cornell box filled by a rising plume of smoke on a voxel grid
+void scene_smokeScene(hittable_list& scene, float dim) {
+	
+	cornell_box(scene, dim);
+	
+	// Gaussian puffs along a wavy column, growing and thinning with height
+	struct Puff {point3 center; double radius, density;};
+	vector<Puff> puffs;
+	mt19937_64 rng(7);
+	uniform_real_distribution<double> unit(-1, 1);
+	for(int i = 0; i < 48; i++) {
+		double h = i / 47.;
+		Puff puff;
+		puff.center  = point3(dim * (.12 * std::sin(6 * h) + .04 * unit(rng)), dim * (.05 + .75 * h), dim * (.5 + .06 * unit(rng)));
+		puff.radius  = dim * (.05 + .1 * h);
+		puff.density = (1 - .6 * h) / dim;
+		puffs.push_back(puff);
+	}
+	
+	// Thin tails are cut, so most bricks stay empty
+	auto density = [puffs, dim](const point3& p) {
+		double sum = 0;
+		for(const Puff& puff : puffs)
+			sum += puff.density * std::exp(-(p - puff.center).len_sqr() / (puff.radius * puff.radius));
+		return (sum * dim < .05) ? 0.f : float(sum);
+	};
+	
+	AABB box(point3(-.45*dim, .01*dim, .05*dim), point3(.45*dim, .95*dim, .95*dim));
+	scene.add(make_shared<Grid_Medium>(box, 128, 128, 128, density, color(.8)));
+}
+
+void scene_meshScene(hittable_list& scene, const char* obj_filename) {
+	
+	auto mesh_mat  = make_shared<Lambertian>(color(.7, .6, .5));
+	auto emit_mat  = make_shared<Emitter>(color(10));
+	auto checker   = make_shared<Checker_Texture>(.3, color(.1), color(.9));
+	
+	auto start_time = chrono::steady_clock::now();
+	auto mesh = load_OBJ(obj_filename, mesh_mat);
+	auto end_time = chrono::steady_clock::now();
+	
+	if(mesh) {
+		cout << "Loaded " << obj_filename << ": "
+			<< mesh->triangle_count() << " triangles in "
+			<< chrono::duration<double, milli>(end_time - start_time).count() << " ms, "
+			<< double(mesh->memory_bytes()) / max<size_t>(mesh->triangle_count(), 1) << " bytes/triangle" << endl;
+		scene.add(mesh);
+	}
+	
+	scene.add(make_shared<Sphere>(point3(0,-1000,0), 1000, make_shared<Lambertian>(checker)));
+	scene.add(make_shared<Sphere>(point3(0,10,5), 3, emit_mat));
+}
+
+// Cornell box with a bouncing ball and a sliding one, under a slow dolly
+void scene_animatedScene(hittable_list& scene, Animation& anim, float dim) {
+	
+	cornell_box(scene, dim);
+	
+	auto metal_mat = make_shared<Metal>(color(.8), 0);
+	auto matte_mat = make_shared<Lambertian>(color(.8, .6, .2));
+	const double r = dim/8;
+	
+	// Falls under gravity and bounces back up, one bounce per second
+	Track<vec3> bounce;
+	for(int i = 0; i <= 32; i++) {
+		const double t = i / 8.;
+		const double phase = t - std::floor(t) - .5;
+		bounce.add(t, vec3(0, dim/2 * (1 - 4 * phase * phase), 0));
+	}
+	auto ball = make_shared<Animated>(make_shared<Sphere>(point3(-dim/5, r, dim/3), r, metal_mat), bounce);
+	
+	Track<vec3> slide;
+	slide.add(0, vec3(0)).add(2, vec3(-dim/2, 0, 0)).add(4, vec3(0));
+	auto slider = make_shared<Animated>(make_shared<Sphere>(point3(dim/4, r, dim/5), r, matte_mat), slide);
+	
+	scene.add(ball);
+	scene.add(slider);
+	anim.objects.push_back(ball);
+	anim.objects.push_back(slider);
+	
+	anim.eye.add(0, point3(0, dim/2, dim)).add(4, point3(dim/6, dim/2, .7*dim));
+	anim.focus.add(0, point3(0, dim/2, -dim)).add(4, point3(-dim/6, dim/3, -dim));
+	anim.duration = 4;
+}
+
+void scene_instanceScene(hittable_list& scene) {
+	// One BLAS replicated through transformed instances,
+	// the scene LBVH built in setup_SCENE is the TLAS over them
+	
+	auto ground_material = make_shared<Lambertian>(make_shared<Checker_Texture>(.5, color(.2, .3, .1), color(.9)));
+	scene.add(make_shared<Sphere>(point3(0,-1000,0), 1000, ground_material));
+	scene.add(make_shared<Sphere>(point3(0,20,0), 5, make_shared<Emitter>(color(8))));
+	
+	// Small cluster of spheres around the origin
+	hittable_list cluster;
+	shared_ptr<IMaterial> metal = make_shared<Metal>(color(.8, .7, .5), .1);
+	auto glass = make_shared<Dielectric>(1.5);
+	shared_ptr<IMaterial> matte = make_shared<Lambertian>(color(.6, .2, .2));
+	cluster.add(make_shared<Sphere>(point3(0, .5, 0), .5, glass));
+	for(int i = 0; i < 6; i++) {
+		double a = i * TWO_PI / 6;
+		cluster.add(make_shared<Sphere>(point3(std::cos(a), .25, std::sin(a)), .25, (i % 2) ? metal : matte));
+	}
+	auto blas = make_shared<LBVH>(cluster);
+	
+	for(int a = -10; a < 10; a++) {
+		for(int b = -10; b < 10; b++) {
+			affine object_to_world = affine::translate(vec3(3*a + get_rand_double(), 0, 3*b + get_rand_double()))
+								   * affine::rotate(1, get_rand_double(0, 360))
+								   * affine::scale(vec3(get_rand_double(.5, 1.2)));
+			scene.add(make_shared<Instance>(blas, object_to_world));
+		}
+	}
+}
+
+void scene_generatedScene(hittable_list& scene, const generator_params& params) {
+	const double e = params.extent;
+	const size_t count = params.count;
+	if(count == 0) return;
+	
+	mt19937_64 rng(params.seed);
+	uniform_real_distribution<double> unit(0, 1);
+	
+	// Small shared palette, so memory is spent on geometry
+	vector<shared_ptr<IMaterial>> materials;
+	vector<color> volume_colors;
+	for(int i = 0; i < 8; i++) {
+		color albedo(unit(rng), unit(rng), unit(rng));
+		if(i < 5)		materials.push_back(make_shared<Lambertian>(albedo));
+		else if(i < 7)	materials.push_back(make_shared<Metal>(albedo, .3 * unit(rng)));
+		else			materials.push_back(make_shared<Dielectric>(1.5));
+		volume_colors.push_back(albedo);
+	}
+	
+	// Clusters: uneven sizes (weight 1/k) and spreads
+	struct Cluster {point3 center; double sigma, radius;};
+	vector<Cluster> clusters;
+	vector<double> cumulative_weight;
+	
+	double layout_radius = 0;
+	if(params.layout == LAYOUT_CLUSTERED) {
+		const size_t cluster_count = max<size_t>(params.cluster_count, 1);
+		double total_weight = 0;
+		for(size_t k = 0; k < cluster_count; k++)
+			total_weight += 1. / (k + 1);
+		
+		double weight_sum = 0;
+		for(size_t k = 0; k < cluster_count; k++) {
+			Cluster c;
+			c.center = point3(e * (2*unit(rng) - 1), e * (2*unit(rng) - 1), e * (2*unit(rng) - 1));
+			c.sigma  = e * (.01 + .05 * unit(rng));
+			
+			// Keeps primitives about as dense as their cluster allows
+			double members = max(1., count * (1. / (k + 1)) / total_weight);
+			c.radius = .3 * std::cbrt(std::pow(4 * c.sigma, 3) / members);
+			clusters.push_back(c);
+			
+			weight_sum += 1. / (k + 1);
+			cumulative_weight.push_back(weight_sum / total_weight);
+		}
+	} else {
+		double volume = (params.layout == LAYOUT_LONG_THIN) ? 2*e * std::pow(2*e / 100, 2) : std::pow(2*e, 3);
+		layout_radius = .3 * std::cbrt(volume / count);
+	}
+	
+	// Chunks are seeded from their index, not from the thread that builds them
+	const size_t chunk_size = 1 << 16;
+	const size_t chunk_count = (count + chunk_size - 1) / chunk_size;
+	vector<vector<shared_ptr<IHittable>>> chunks(chunk_count);
+	
+	#pragma omp parallel for schedule(dynamic)
+	for(size_t chunk = 0; chunk < chunk_count; chunk++) {
+		mt19937_64 gen(params.seed ^ (0x9E3779B97F4A7C15ULL * (chunk + 1)));
+		uniform_real_distribution<double> u(0, 1);
+		normal_distribution<double> gauss(0, 1);
+		
+		const size_t first = chunk * chunk_size;
+		const size_t last = min(count, first + chunk_size);
+		vector<shared_ptr<IHittable>>& out = chunks[chunk];
+		out.reserve(last - first);
+		
+		for(size_t i = first; i < last; i++) {
+			point3 p;
+			double radius = layout_radius;
+			
+			switch(params.layout) {
+				case LAYOUT_UNIFORM:
+					p = point3(e * (2*u(gen) - 1), e * (2*u(gen) - 1), e * (2*u(gen) - 1));
+					break;
+				case LAYOUT_LONG_THIN:
+					p = point3(e * (2*u(gen) - 1), e/100 * (2*u(gen) - 1), e/100 * (2*u(gen) - 1));
+					break;
+				case LAYOUT_CLUSTERED: {
+					size_t k = lower_bound(cumulative_weight.begin(), cumulative_weight.end(), u(gen)) - cumulative_weight.begin();
+					const Cluster& c = clusters[min(k, clusters.size() - 1)];
+					p = c.center + c.sigma * vec3(gauss(gen), gauss(gen), gauss(gen));
+					radius = c.radius;
+					break;
+				}
+			}
+			
+			radius *= .5 + u(gen);
+			const int m = int(u(gen) * materials.size()) % materials.size();
+			const double kind = u(gen);
+			
+			if(kind < params.volume_fraction) {
+				auto boundary = make_shared<Sphere>(p, radius, materials[m]);
+				out.push_back(make_shared<Constant_Medium>(boundary, 1. / radius, volume_colors[m]));
+			} else if(kind < params.volume_fraction + params.quad_fraction) {
+				vec3 a = normalized(vec3(gauss(gen), gauss(gen), gauss(gen)));
+				vec3 b = normalized(cross(a, vec3(gauss(gen), gauss(gen), gauss(gen))));
+				out.push_back(make_shared<Quad>(p - radius * (a + b), 2 * radius * a, 2 * radius * b, materials[m]));
+			} else {
+				out.push_back(make_shared<Sphere>(p, radius, materials[m]));
+			}
+		}
+	}
+	
+	scene.objects.reserve(scene.objects.size() + count);
+	for(auto& chunk : chunks) {
+		for(auto& obj : chunk)
+			scene.add(obj);
+		vector<shared_ptr<IHittable>>().swap(chunk);
+	}
+}
\ No newline at end of file
@@ -1,4 +1,10 @@
+#include <cstdio>
+#include <cmath>
+#include <algorithm>
+#include <vector>
+
 #include "utils.h"
+#include "defs/aabb.h"
 
 inline double linear_to_gamma(double linear_component)
 {
@@ -28,7 +34,69 @@ uint32_t get_color(const color& pixel_color){
 }
 
 
+bool write_ppm(const char* path, const uint32_t* pixels, int width, int height) {
+	FILE* file = fopen(path, "wb");
+	if(!file) {
+		perror("Could not write image");
+		return false;
+	}
+	
+	fprintf(file, "P6\n%d %d\n255\n", width, height);
+	std::vector<unsigned char> row(3 * size_t(width));
+	for(int y = 0; y < height; y++) {
+		for(int x = 0; x < width; x++) {
+			const uint32_t p = pixels[size_t(y) * width + x];
+			row[3*x]   = p >> 16;
+			row[3*x+1] = p >> 8;
+			row[3*x+2] = p;
+		}
+		fwrite(row.data(), 1, row.size(), file);
+	}
+	
+	return fclose(file) == 0;
+}
+
+
+#ifdef STATS_MODE
+	thread_local frame_stats thread_stats;
+#endif
+
+bool write_heatmap(const char* path, const Float_Image& cost) {
+	FILE* file = fopen(path, "wb");
+	if(!file) {
+		perror("Could not write heatmap");
+		return false;
+	}
+	
+	const float* c = cost.plane(0);
+	float max_cost = 0;
+	for(size_t i = 0; i < cost.size(); i++)
+		max_cost = std::max(max_cost, c[i]);
+	const float scale = (max_cost > 0) ? 1.f / std::log1p(max_cost) : 0.f;
+	
+	// Black, blue, red, yellow
+	static const float stops[4][3] = {{0, 0, 0}, {0, 0, 1}, {1, 0, 0}, {1, 1, 0}};
+	
+	fprintf(file, "P6\n%d %d\n255\n", cost.width, cost.height);
+	for(size_t i = 0; i < cost.size(); i++) {
+		float x = std::log1p(c[i]) * scale * 3;
+		int k = std::min(int(x), 2);
+		float f = x - k;
+		
+		unsigned char rgb[3];
+		for(int ch = 0; ch < 3; ch++)
+			rgb[ch] = 255 * ((1 - f) * stops[k][ch] + f * stops[k+1][ch]);
+		fwrite(rgb, 1, 3, file);
+	}
+	
+	return fclose(file) == 0;
+}
+
+
 const interval interval::empty = interval();
 const interval interval::universe = interval(-inf, +inf);
-const interval interval::positive = interval(0.001, +inf);
+const interval interval::positive = interval(0, +inf);
 const interval interval::unit = interval(0, 1);
+
+const AABB AABB::empty    = AABB(interval::empty);
+const AABB AABB::universe = AABB(interval::universe);